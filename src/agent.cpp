@@ -3,18 +3,30 @@
 #include <jvmti.h>
 #include <iostream>
 #include <unordered_map>
+#include <atomic>
 #include <cstring>
+#include <mutex>
 #include "log.h"
 #include "global_data.h"
 #include "utils.h"
 #include "roots/paths_to_closest_gc_roots.h"
+#include "roots/referring_objects.h"
+#include "roots/path_between_objects.h"
 #include "reachability/objects_of_class_in_heap.h"
+#include "reachability/reachability_overlap.h"
 #include "sizes/shallow_size_by_classes.h"
 #include "sizes/retained_size_and_held_objects.h"
 #include "sizes/retained_size_via_dominator_tree.h"
 #include "sizes/retained_size_by_classes.h"
 #include "allocation_sampling.h"
+#include "allocation_sites.h"
+#include "allocation_profile_export.h"
+#include "class_index.h"
+#include "object_watch_list.h"
 #include "sizes/retained_size_by_objects.h"
+#include "sizes/retained_size_by_threads.h"
+#include "sizes/deep_size.h"
+#include "sizes/class_histogram.h"
 
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 
@@ -23,6 +35,9 @@
 
 static GlobalAgentData *gdata = nullptr;
 static bool canSampleAllocations = false;
+// Written by enabling and disabling calls outside of the mode lock, the last mode update reads the latest value
+static std::atomic<bool> isAllocationSamplingAllowed{true};
+static std::mutex allocationSamplingModeMutex;
 
 static void setRequiredCapabilities(jvmtiEnv *jvmti, jvmtiCapabilities &effective) {
     jvmtiCapabilities potential;
@@ -46,12 +61,17 @@ static void setRequiredCapabilities(jvmtiEnv *jvmti, jvmtiCapabilities &effectiv
     }
 }
 
-static jboolean setAllocationSamplingMode(jvmtiEventMode mode) {
-    if (canSampleAllocations) {
-        jvmtiError error = gdata->jvmti->SetEventNotificationMode(mode, JVMTI_EVENT_SAMPLED_OBJECT_ALLOC, NULL);
-        return (jboolean) error == JVMTI_ERROR_NONE;
+// Allocation events are enabled only while something consumes them, so an idle agent costs nothing on allocations
+static jboolean updateAllocationSamplingMode() {
+    if (!canSampleAllocations) {
+        return (jboolean) 0;
     }
-    return (jboolean) 0;
+
+    std::lock_guard<std::mutex> lock(allocationSamplingModeMutex);
+    bool hasConsumers = arrayOfListeners.hasListeners() || allocationSites.isActive();
+    jvmtiEventMode mode = isAllocationSamplingAllowed && hasConsumers ? JVMTI_ENABLE : JVMTI_DISABLE;
+    jvmtiError error = gdata->jvmti->SetEventNotificationMode(mode, JVMTI_EVENT_SAMPLED_OBJECT_ALLOC, NULL);
+    return (jboolean) (error == JVMTI_ERROR_NONE);
 }
 
 JNIEXPORT jint JNICALL Agent_OnLoad(JavaVM *jvm, char *options, void *reserved) {
@@ -74,20 +94,36 @@ JNIEXPORT jint JNICALL Agent_OnLoad(JavaVM *jvm, char *options, void *reserved)
         return JNI_ERR;
     }
 
-    if (canSampleAllocations) {
-        error = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_SAMPLED_OBJECT_ALLOC, NULL);
-        if (error != JVMTI_ERROR_NONE) {
-            handleError(jvmti, error, "Could not set allocation sampling notification mode");
-            return JNI_ERR;
-        }
-    }
-
     logger::debug("set callbacks");
     jvmtiEventCallbacks callbacks;
     std::memset(&callbacks, 0, sizeof(jvmtiEventCallbacks));
     callbacks.SampledObjectAlloc = SampledObjectAlloc;
+    callbacks.ThreadEnd = SamplingThreadEnd;
     jvmti->SetEventCallbacks(&callbacks, sizeof(jvmtiEventCallbacks));
 
+    logger::debug("create class index");
+    error = classIndex.init(jvm);
+    if (error != JVMTI_ERROR_NONE) {
+        handleError(jvmti, error, "Could not create class index");
+        return JNI_ERR;
+    }
+
+    logger::debug("create object watch list");
+    error = objectWatchList.init(jvm);
+    if (error != JVMTI_ERROR_NONE) {
+        // Not fatal: only watching objects becomes unavailable
+        handleError(jvmti, error, "Could not create object watch list");
+    }
+
+    if (canSampleAllocations) {
+        logger::debug("create allocation sites profile");
+        error = allocationSites.init(jvm);
+        if (error != JVMTI_ERROR_NONE) {
+            handleError(jvmti, error, "Could not create allocation sites profile");
+            return JNI_ERR;
+        }
+    }
+
     gdata = new GlobalAgentData();
     gdata->jvmti = jvmti;
     logger::debug("initializing done");
@@ -168,6 +204,34 @@ JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentPro
     return RetainedSizeAndHeldObjectsAction(env, gdata->jvmti, thisObject).run(object);
 }
 
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getHeldObjectsHistogram(
+        JNIEnv *env,
+        jobject thisObject,
+        jobject object) {
+    return HeldObjectsHistogramAction(env, gdata->jvmti, thisObject).run(object);
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getHeldObjectsOfClass(
+        JNIEnv *env,
+        jobject thisObject,
+        jobject object,
+        jobject classObject,
+        jint offset,
+        jint limit) {
+    return HeldObjectsOfClassAction(env, gdata->jvmti, thisObject).run(object, classObject, offset, limit);
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_deepSize(
+        JNIEnv *env,
+        jobject thisObject,
+        jobject object,
+        jint depthLimit) {
+    return DeepSizeAction(env, gdata->jvmti, thisObject).run(object, depthLimit);
+}
+
 extern "C"
 JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_findPathsToClosestGcRoots(
         JNIEnv *env,
@@ -186,6 +250,14 @@ JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentPro
     return ShallowSizeByClassesAction(env, gdata->jvmti, thisObject).run(classesArray);
 }
 
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getClassHistogram(
+        JNIEnv *env,
+        jobject thisObject,
+        jint classesLimit) {
+    return ClassHistogramAction(env, gdata->jvmti, thisObject).run(classesLimit);
+}
+
 extern "C"
 JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getRetainedSizeByClasses(
         JNIEnv *env,
@@ -220,6 +292,34 @@ JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentPro
     return GetAllReachableObjectsOfClassAction(env, gdata->jvmti, thisObject).run(startObject, suspectClass);
 }
 
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getReachableObjectsOfClasses(
+        JNIEnv *env,
+        jobject thisObject,
+        jobject startObject,
+        jobjectArray classes,
+        jint mode) {
+    return GetReachableObjectsOfClassesAction(env, gdata->jvmti, thisObject).run(startObject, classes, mode);
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getReachableObjectsStatisticsOfClasses(
+        JNIEnv *env,
+        jobject thisObject,
+        jobject startObject,
+        jobjectArray classes,
+        jint samplesLimit) {
+    return GetReachableObjectsStatisticsOfClassesAction(env, gdata->jvmti, thisObject).run(startObject, classes, samplesLimit);
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getReachabilityOverlap(
+        JNIEnv *env,
+        jobject thisObject,
+        jobjectArray objects) {
+    return ReachabilityOverlapAction(env, gdata->jvmti, thisObject).run(objects);
+}
+
 extern "C"
 JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getShallowAndRetainedSizesByObjects(
         JNIEnv *env,
@@ -228,6 +328,23 @@ JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentPro
     return RetainedSizesViaDominatorTreeAction(env, gdata->jvmti, thisObject).run(objects);
 }
 
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getShallowAndRetainedSizesAndHeldObjectsByObjects(
+        JNIEnv *env,
+        jobject thisObject,
+        jobjectArray objects) {
+    return RetainedSizesAndHeldObjectsViaDominatorTreeAction(env, gdata->jvmti, thisObject).run(objects);
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getShallowAndRetainedSizesByGroups(
+        JNIEnv *env,
+        jobject thisObject,
+        jobjectArray objects,
+        jintArray groupIds) {
+    return RetainedSizesByGroupsAction(env, gdata->jvmti, thisObject).run(objects, groupIds);
+}
+
 extern "C"
 JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getSortedShallowAndRetainedSizesByClass(
         JNIEnv *env,
@@ -237,6 +354,61 @@ JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentPro
     return RetainedSizesByClassViaDominatorTreeAction(env, gdata->jvmti, thisObject).run(classRef, objectsLimit);
 }
 
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getRetainedSizesByThreads(
+        JNIEnv *env,
+        jobject thisObject) {
+    return RetainedSizesByThreadsAction(env, gdata->jvmti, thisObject).run();
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getReferringObjects(
+        JNIEnv *env,
+        jobject thisObject,
+        jobjectArray objects,
+        jint offset,
+        jint limit) {
+    return ReferringObjectsAction(env, gdata->jvmti, thisObject).run(objects, offset, limit);
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_findPathBetweenObjects(
+        JNIEnv *env,
+        jobject thisObject,
+        jobject source,
+        jobject target,
+        jint depthLimit) {
+    return PathBetweenObjectsAction(env, gdata->jvmti, thisObject).run(source, target, depthLimit);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_watchObjects(
+        JNIEnv *env,
+        jobject thisObject,
+        jobjectArray objects) {
+    jvmtiError error = objectWatchList.watch(env, objects);
+    if (error != JVMTI_ERROR_NONE) {
+        handleError(gdata->jvmti, error, "Could not watch objects");
+        return (jboolean) 0;
+    }
+    return (jboolean) 1;
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getWatchedObjectsSurvivors(
+        JNIEnv *env,
+        jobject thisObject,
+        jint minGcCycles) {
+    return objectWatchList.getSurvivors(env, minGcCycles);
+}
+
+extern "C"
+JNIEXPORT void JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_clearWatchedObjects(
+        JNIEnv *env,
+        jobject thisObject) {
+    objectWatchList.clear();
+}
+
 extern "C"
 JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_setHeapSamplingInterval(
         JNIEnv *env,
@@ -246,6 +418,22 @@ JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_s
         return (jboolean) 0;
     }
 
+    samplingIntervalController.setInterval(static_cast<jint>(interval));
+    return (jboolean) 1;
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_setAdaptiveHeapSampling(
+        JNIEnv *env,
+        jclass thisClass,
+        jlong samplesPerSecond,
+        jint minInterval,
+        jint maxInterval) {
+    if (!canSampleAllocations) {
+        return (jboolean) 0;
+    }
+
+    samplingIntervalController.setTarget(samplesPerSecond, minInterval, maxInterval);
     return (jboolean) 1;
 }
 
@@ -257,22 +445,129 @@ JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_i
     if (!canSampleAllocations) {
         return (jboolean) 0;
     }
-    arrayOfListeners.init(env, array);
+    // Listeners themselves come with every change through updateAllocationListeners
+    arrayOfListeners.init(gdata->jvmti, env);
     return (jboolean) 1;
 }
 
+extern "C"
+JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_updateAllocationListeners(
+        JNIEnv *env,
+        jclass thisClass,
+        jobjectArray listenerHolders,
+        jobjectArray trackedClasses) {
+    if (!canSampleAllocations) {
+        return (jboolean) 0;
+    }
+    arrayOfListeners.update(env, listenerHolders, trackedClasses);
+    return updateAllocationSamplingMode();
+}
+
 extern "C"
 JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_enableAllocationSampling(
         JNIEnv *env,
         jclass thisClass) {
-    return setAllocationSamplingMode(JVMTI_ENABLE);
+    isAllocationSamplingAllowed = true;
+    return updateAllocationSamplingMode();
 }
 
 extern "C"
 JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_disableAllocationSampling(
         JNIEnv *env,
         jclass thisClass) {
-    return setAllocationSamplingMode(JVMTI_DISABLE);
+    isAllocationSamplingAllowed = false;
+    return updateAllocationSamplingMode();
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_setAllocationStackDepth(
+        JNIEnv *env,
+        jclass thisClass,
+        jint depth) {
+    if (!canSampleAllocations) {
+        return (jboolean) 0;
+    }
+    allocationSites.setStackDepth(depth);
+    return updateAllocationSamplingMode();
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getAllocationSites(
+        JNIEnv *env,
+        jclass thisClass) {
+    return allocationSites.getFoldedStacks(env);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_setLiveObjectsSampling(
+        JNIEnv *env,
+        jclass thisClass,
+        jboolean enabled) {
+    if (!canSampleAllocations) {
+        return (jboolean) 0;
+    }
+    if (!allocationSites.setLiveObjectsTracking(enabled)) {
+        return (jboolean) 0;
+    }
+    return updateAllocationSamplingMode();
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getLiveSampledObjects(
+        JNIEnv *env,
+        jclass thisClass,
+        jboolean bySite) {
+    return allocationSites.getLiveObjects(env, bySite);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_setClassAllocationCounting(
+        JNIEnv *env,
+        jclass thisClass,
+        jboolean enabled) {
+    if (!canSampleAllocations) {
+        return (jboolean) 0;
+    }
+    allocationSites.setClassCounting(enabled);
+    return updateAllocationSamplingMode();
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_getClassAllocationCountersDelta(
+        JNIEnv *env,
+        jclass thisClass) {
+    return allocationSites.getClassCountersDelta(env);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_startAllocationProfileExport(
+        JNIEnv *env,
+        jclass thisClass,
+        jstring path,
+        jlong periodMillis) {
+    if (!canSampleAllocations) {
+        return (jboolean) 0;
+    }
+    jvmtiError error = allocationProfileExporter.start(gdata->jvmti, env, jstringTostring(env, path), periodMillis);
+    if (error != JVMTI_ERROR_NONE) {
+        return (jboolean) 0;
+    }
+    return updateAllocationSamplingMode();
+}
+
+extern "C"
+JNIEXPORT void JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_stopAllocationProfileExport(
+        JNIEnv *env,
+        jclass thisClass) {
+    allocationProfileExporter.stop();
+    updateAllocationSamplingMode();
+}
+
+extern "C"
+JNIEXPORT void JNICALL Java_com_intellij_memory_agent_IdeaNativeAgentProxy_clearAllocationSites(
+        JNIEnv *env,
+        jclass thisClass) {
+    allocationSites.clear();
 }
 
 #pragma clang diagnostic pop
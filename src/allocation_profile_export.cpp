@@ -0,0 +1,224 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <chrono>
+#include "allocation_profile_export.h"
+#include "allocation_sites.h"
+#include "log.h"
+#include "utils.h"
+
+// The export thread may still run when the VM exits, so it is never destroyed
+AllocationProfileExporter &allocationProfileExporter = *new AllocationProfileExporter();
+
+namespace {
+    const char *MAGIC = "MAPF";
+    const uint64_t FORMAT_VERSION = 1;
+    const size_t BUFFER_CAPACITY = 64 * 1024;
+    const char *exportThreadName = "Memory Agent Allocation Profile Export";
+}
+
+jvmtiError AllocationProfileExporter::start(jvmtiEnv *jvmti, JNIEnv *env, const std::string &path, jlong periodMillis) {
+    if (running.load() || periodMillis <= 0) {
+        return JVMTI_ERROR_ILLEGAL_ARGUMENT;
+    }
+
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return JVMTI_ERROR_ILLEGAL_ARGUMENT;
+    }
+
+    buffer.clear();
+    buffer.reserve(BUFFER_CAPACITY);
+    period = std::chrono::milliseconds(periodMillis);
+    stopRequested = false;
+    writeFailed = false;
+    exportedCounts.clear();
+    exportedSizes.clear();
+    allocationSites.getSiteCounters(&exportedGeneration);
+    exportedClasses.clear();
+    exportedStacks.clear();
+    methodIds.clear();
+    for (const char *c = MAGIC; *c; c++) {
+        writeByte(static_cast<uint8_t>(*c));
+    }
+    writeVarint(FORMAT_VERSION);
+
+    jclass threadClass = env->FindClass("java/lang/Thread");
+    jmethodID constructor = env->GetMethodID(threadClass, "<init>", "(Ljava/lang/String;)V");
+    jobject thread = env->NewObject(threadClass, constructor, env->NewStringUTF(exportThreadName));
+    if (thread == nullptr) {
+        env->ExceptionClear();
+        std::fclose(file);
+        return JVMTI_ERROR_OUT_OF_MEMORY;
+    }
+
+    running.store(true);
+    allocationSites.setSitesCollection(true);
+    jvmtiError err = jvmti->RunAgentThread(thread, exportProfile, this, JVMTI_THREAD_NORM_PRIORITY);
+    if (!isOk(err)) {
+        allocationSites.setSitesCollection(false);
+        running.store(false);
+        std::fclose(file);
+    }
+    return err;
+}
+
+void AllocationProfileExporter::stop() {
+    // Sites collected so far still go to the last record
+    allocationSites.setSitesCollection(false);
+    std::unique_lock<std::mutex> lock(mutex);
+    stopRequested = true;
+    stopCondition.notify_all();
+    // The last record is written and the file is closed before returning, so an export can start right away
+    stopCondition.wait(lock, [this] { return !running.load(); });
+}
+
+bool AllocationProfileExporter::isRunning() const {
+    return running.load();
+}
+
+void JNICALL AllocationProfileExporter::exportProfile(jvmtiEnv *jvmti, JNIEnv *env, void *arg) {
+    auto *exporter = reinterpret_cast<AllocationProfileExporter *>(arg);
+    bool stopped = false;
+    // A failed write would leave a truncated record, so nothing is written after it
+    while (!stopped && !exporter->writeFailed) {
+        {
+            std::unique_lock<std::mutex> lock(exporter->mutex);
+            exporter->stopCondition.wait_for(lock, exporter->period, [exporter] { return exporter->stopRequested; });
+            stopped = exporter->stopRequested;
+        }
+        exporter->writeDelta(env);
+        exporter->flush();
+    }
+    if (exporter->writeFailed) {
+        allocationSites.setSitesCollection(false);
+    }
+
+    std::lock_guard<std::mutex> lock(exporter->mutex);
+    std::fclose(exporter->file);
+    exporter->file = nullptr;
+    exporter->running.store(false);
+    exporter->stopCondition.notify_all();
+}
+
+void AllocationProfileExporter::writeDelta(JNIEnv *env) {
+    uint64_t generation;
+    std::unordered_map<uint64_t, AllocationSites::Counters> sites = allocationSites.getSiteCounters(&generation);
+    // Counters start from zero again after the sites are cleared
+    if (generation != exportedGeneration) {
+        exportedCounts.clear();
+        exportedSizes.clear();
+        exportedGeneration = generation;
+    }
+
+    std::vector<std::pair<uint64_t, AllocationSites::Counters>> changedSites;
+    for (auto &entry : sites) {
+        jlong &exportedCount = exportedCounts[entry.first];
+        jlong &exportedSize = exportedSizes[entry.first];
+        if (entry.second.count == exportedCount) continue;
+
+        changedSites.emplace_back(entry.first, AllocationSites::Counters{entry.second.count - exportedCount,
+                                                                          entry.second.size - exportedSize});
+        exportedCount = entry.second.count;
+        exportedSize = entry.second.size;
+    }
+    if (changedSites.empty()) {
+        return;
+    }
+
+    for (auto &site : changedSites) {
+        writeClass(env, static_cast<jint>(site.first & 0xFFFFFFFFu));
+        writeStack(static_cast<jint>(site.first >> 32));
+    }
+
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    writeByte(SAMPLES);
+    writeVarint(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count()));
+    writeVarint(changedSites.size());
+    for (auto &site : changedSites) {
+        writeVarint(site.first >> 32);
+        writeVarint(site.first & 0xFFFFFFFFu);
+        writeVarint(static_cast<uint64_t>(site.second.count));
+        writeVarint(static_cast<uint64_t>(site.second.size));
+    }
+}
+
+void AllocationProfileExporter::writeClass(JNIEnv *env, jint classId) {
+    if (exportedClasses.size() <= static_cast<size_t>(classId)) {
+        exportedClasses.resize(classId + 1);
+    }
+    if (exportedClasses[classId]) return;
+
+    exportedClasses[classId] = true;
+    writeByte(CLASS);
+    writeVarint(static_cast<uint64_t>(classId));
+    writeString(allocationSites.getClassName(env, classId));
+}
+
+void AllocationProfileExporter::writeStack(jint stackId) {
+    if (exportedStacks.size() <= static_cast<size_t>(stackId)) {
+        exportedStacks.resize(stackId + 1);
+    }
+    if (exportedStacks[stackId]) return;
+
+    exportedStacks[stackId] = true;
+    std::vector<jmethodID> stack = allocationSites.getStack(stackId);
+    std::vector<uint64_t> frames;
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+        auto methodIt = methodIds.find(*it);
+        if (methodIt == methodIds.end()) {
+            methodIt = methodIds.emplace(*it, methodIds.size()).first;
+            writeByte(METHOD);
+            writeVarint(methodIt->second);
+            writeString(allocationSites.getMethodName(*it));
+        }
+        frames.push_back(methodIt->second);
+    }
+
+    writeByte(STACK);
+    writeVarint(static_cast<uint64_t>(stackId));
+    writeVarint(frames.size());
+    for (uint64_t frame : frames) {
+        writeVarint(frame);
+    }
+}
+
+void AllocationProfileExporter::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        writeByte(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    writeByte(static_cast<uint8_t>(value));
+}
+
+void AllocationProfileExporter::writeString(const std::string &value) {
+    writeVarint(value.size());
+    for (char c : value) {
+        writeByte(static_cast<uint8_t>(c));
+    }
+}
+
+void AllocationProfileExporter::writeByte(uint8_t value) {
+    if (writeFailed) return;
+    if (buffer.size() == BUFFER_CAPACITY) {
+        flush();
+    }
+    buffer.push_back(value);
+}
+
+void AllocationProfileExporter::flush() {
+    if (writeFailed) return;
+    if (!buffer.empty()) {
+        size_t written = std::fwrite(buffer.data(), 1, buffer.size(), file);
+        bool isComplete = written == buffer.size();
+        buffer.clear();
+        if (!isComplete) {
+            logger::error("could not write allocation profile, export stopped");
+            writeFailed = true;
+            return;
+        }
+    }
+    if (std::fflush(file) != 0) {
+        logger::error("could not flush allocation profile, export stopped");
+        writeFailed = true;
+    }
+}
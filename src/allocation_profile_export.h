@@ -0,0 +1,73 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_ALLOCATION_PROFILE_EXPORT_H
+#define MEMORY_AGENT_ALLOCATION_PROFILE_EXPORT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "jni.h"
+#include "jvmti.h"
+
+/*
+ * Streams aggregated allocation sites to a file from an agent thread. The file starts with
+ * the "MAPF" magic and a varint format version, followed by records of a type byte and
+ * unsigned LEB128 varints:
+ *   CLASS:   id, name length, name bytes
+ *   METHOD:  id, name length, name bytes
+ *   STACK:   id, frames count, method ids from the outermost frame
+ *   SAMPLES: milliseconds since epoch, sites count, then stack id, class id, count and bytes per site
+ * Every period only sites that changed since the previous SAMPLES record are written, preceded by
+ * the classes, methods and stacks that were not written yet.
+ */
+class AllocationProfileExporter {
+public:
+    jvmtiError start(jvmtiEnv *jvmti, JNIEnv *env, const std::string &path, jlong periodMillis);
+
+    void stop();
+
+    bool isRunning() const;
+
+private:
+    enum RecordType : uint8_t {
+        CLASS = 1,
+        METHOD = 2,
+        STACK = 3,
+        SAMPLES = 4
+    };
+
+    static void JNICALL exportProfile(jvmtiEnv *jvmti, JNIEnv *env, void *arg);
+    void writeDelta(JNIEnv *env);
+    void writeClass(JNIEnv *env, jint classId);
+    void writeStack(jint stackId);
+    void writeVarint(uint64_t value);
+    void writeString(const std::string &value);
+    void writeByte(uint8_t value);
+    void flush();
+
+private:
+    std::FILE *file = nullptr;
+    std::vector<uint8_t> buffer;
+    std::chrono::milliseconds period{0};
+    std::atomic<bool> running{false};
+    bool stopRequested = false;
+    bool writeFailed = false;
+    std::mutex mutex;
+    std::condition_variable stopCondition;
+
+    std::unordered_map<uint64_t, jlong> exportedCounts;
+    std::unordered_map<uint64_t, jlong> exportedSizes;
+    uint64_t exportedGeneration = 0;
+    std::vector<bool> exportedClasses;
+    std::vector<bool> exportedStacks;
+    std::unordered_map<jmethodID, uint64_t> methodIds;
+};
+
+extern AllocationProfileExporter &allocationProfileExporter;
+
+#endif //MEMORY_AGENT_ALLOCATION_PROFILE_EXPORT_H
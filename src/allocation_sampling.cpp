@@ -1,46 +1,372 @@
 // Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <new>
 #include "allocation_sampling.h"
+#include "allocation_sites.h"
+#include "log.h"
 #include "utils.h"
 
-const char *ArrayOfListeners::arrayOfListenersClassName = "com/intellij/memory/agent/ArrayOfListeners";
-const char *ArrayOfListeners::listenerHoldersFieldName = "listenerHolders";
-const char *ArrayOfListeners::listenerHoldersFieldSignature = "[Ljava/lang/Object;";
+namespace {
+    const size_t SAMPLES_BUFFER_CAPACITY = 1 << 14;
+    const size_t MAX_BATCH_SIZE = 1024;
+    const std::chrono::milliseconds DELIVERY_PERIOD(10);
+    const jint MAX_CACHED_CLASS_ID = 1 << 16;
+    const jlong ADJUSTMENT_PERIOD_NANOS = 1000 * 1000 * 1000;
+    const double MAX_ADJUSTMENT_FACTOR = 4;
+
+    // Allocations of the listeners themselves are not sampled to avoid feeding the buffer from its consumer
+    thread_local bool isDeliveryThread = false;
+
+    // Global reference to the current thread shared by its samples
+    thread_local jthread currentThreadReference = nullptr;
+}
+
 const char *ArrayOfListeners::listenerHolderClassName = "com/intellij/memory/agent/AllocationListenerHolder";
 const char *ArrayOfListeners::notificationMethodName = "notifyListenerIfNeeded";
-const char *ArrayOfListeners::notificationMethodSignature = "(Ljava/lang/Thread;Ljava/lang/Object;Ljava/lang/Class;J)V";
+const char *ArrayOfListeners::notificationMethodSignature = "([Ljava/lang/Thread;[Ljava/lang/Object;[Ljava/lang/Class;[J)V";
+const char *ArrayOfListeners::deliveryThreadName = "Memory Agent Allocation Listeners";
 
-ArrayOfListeners arrayOfListeners;
+// The delivery thread keeps using it until the VM exits, so it is never destroyed. Plain new doesn't
+// honor the alignment of its buffer positions before C++17, so it is constructed in static storage.
+alignas(ArrayOfListeners) static unsigned char arrayOfListenersStorage[sizeof(ArrayOfListeners)];
+ArrayOfListeners &arrayOfListeners = *new (arrayOfListenersStorage) ArrayOfListeners();
+SamplingIntervalController samplingIntervalController;
 
 extern "C" JNIEXPORT void JNICALL SampledObjectAlloc(jvmtiEnv *jvmti, JNIEnv *env, jthread thread,
                                                      jobject object, jclass klass, jlong size) {
-    arrayOfListeners.notifyAll(env, thread, object, klass, size);
+    jint classId = allocationSites.getClassId(env, klass);
+    allocationSites.onAllocation(env, object, classId, samplingIntervalController.estimateAllocatedBytes(size));
+    arrayOfListeners.onAllocation(env, thread, object, klass, classId, size);
+    samplingIntervalController.onSample(jvmti);
+}
+
+extern "C" JNIEXPORT void JNICALL SamplingThreadEnd(jvmtiEnv *jvmti, JNIEnv *env, jthread thread) {
+    arrayOfListeners.onThreadEnd();
+}
+
+void SamplingIntervalController::setInterval(jint newInterval) {
+    targetRate.store(0, std::memory_order_relaxed);
+    interval.store(newInterval, std::memory_order_relaxed);
+}
+
+void SamplingIntervalController::setTarget(jlong samplesPerSecond, jint newMinInterval, jint newMaxInterval) {
+    minInterval.store(std::max(newMinInterval, 0), std::memory_order_relaxed);
+    maxInterval.store(newMaxInterval > 0 ? std::max(newMaxInterval, newMinInterval) : std::numeric_limits<jint>::max(),
+                      std::memory_order_relaxed);
+    periodSamples.store(0, std::memory_order_relaxed);
+    periodStart.store(nowNanos(), std::memory_order_relaxed);
+    targetRate.store(std::max<jlong>(samplesPerSecond, 0), std::memory_order_relaxed);
+}
+
+void SamplingIntervalController::onSample(jvmtiEnv *jvmti) {
+    jlong target = targetRate.load(std::memory_order_relaxed);
+    if (target == 0) {
+        return;
+    }
+
+    jlong samples = periodSamples.fetch_add(1, std::memory_order_relaxed) + 1;
+    jlong start = periodStart.load(std::memory_order_relaxed);
+    jlong now = nowNanos();
+    jlong elapsed = now - start;
+    if (elapsed < ADJUSTMENT_PERIOD_NANOS && samples < 2 * target) {
+        return;
+    }
+    // Only the thread that ends the period adjusts the interval
+    if (elapsed <= 0 || !periodStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+        return;
+    }
+    periodSamples.store(0, std::memory_order_relaxed);
+
+    double observedRate = static_cast<double>(samples) * 1e9 / static_cast<double>(elapsed);
+    double factor = std::min(std::max(observedRate / static_cast<double>(target), 1 / MAX_ADJUSTMENT_FACTOR), MAX_ADJUSTMENT_FACTOR);
+    double newInterval = std::max(static_cast<double>(interval.load(std::memory_order_relaxed)), 1.0) * factor;
+    newInterval = std::min(std::max(newInterval, static_cast<double>(minInterval.load(std::memory_order_relaxed))),
+                           static_cast<double>(maxInterval.load(std::memory_order_relaxed)));
+    auto roundedInterval = static_cast<jint>(newInterval);
+    if (roundedInterval != interval.load(std::memory_order_relaxed) && isOk(jvmti->SetHeapSamplingInterval(roundedInterval))) {
+        interval.store(roundedInterval, std::memory_order_relaxed);
+    }
+}
+
+jlong SamplingIntervalController::estimateAllocatedBytes(jlong size) const {
+    jint currentInterval = interval.load(std::memory_order_relaxed);
+    if (currentInterval <= 0 || size <= 0) {
+        return size;
+    }
+
+    // An object of this size is sampled with probability 1 - exp(-size / interval)
+    double probability = -std::expm1(-static_cast<double>(size) / currentInterval);
+    return static_cast<jlong>(static_cast<double>(size) / probability);
+}
+
+jlong SamplingIntervalController::nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+AllocationSamplesBuffer::AllocationSamplesBuffer(size_t capacity) :
+    cells(new Cell[capacity]), mask(capacity - 1), enqueuePosition(0), dequeuePosition(0) {
+    for (size_t i = 0; i < capacity; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool AllocationSamplesBuffer::tryClaim(size_t &position) {
+    position = enqueuePosition.load(std::memory_order_relaxed);
+    while (true) {
+        Cell &cell = cells[position & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void AllocationSamplesBuffer::publish(size_t position, const AllocationSample &sample) {
+    Cell &cell = cells[position & mask];
+    cell.sample = sample;
+    cell.sequence.store(position + 1, std::memory_order_release);
+}
+
+bool AllocationSamplesBuffer::tryPop(AllocationSample &sample) {
+    size_t position = dequeuePosition.load(std::memory_order_relaxed);
+    Cell &cell = cells[position & mask];
+    if (cell.sequence.load(std::memory_order_acquire) != position + 1) {
+        return false;
+    }
+
+    sample = cell.sample;
+    cell.sequence.store(position + mask + 1, std::memory_order_release);
+    dequeuePosition.store(position + 1, std::memory_order_relaxed);
+    return true;
+}
+
+size_t AllocationSamplesBuffer::size() const {
+    return enqueuePosition.load(std::memory_order_relaxed) - dequeuePosition.load(std::memory_order_relaxed);
+}
+
+AllocationClassFilter::AllocationClassFilter(JNIEnv *env, jobjectArray classes) :
+    decisions(new std::atomic<uint8_t>[MAX_CACHED_CLASS_ID]) {
+    env->GetJavaVM(&vm);
+    for (jsize i = 0; i < env->GetArrayLength(classes); i++) {
+        jobject klass = env->GetObjectArrayElement(classes, i);
+        trackedClasses.push_back(reinterpret_cast<jclass>(env->NewGlobalRef(klass)));
+        env->DeleteLocalRef(klass);
+    }
+    for (jint i = 0; i < MAX_CACHED_CLASS_ID; i++) {
+        decisions[i].store(UNKNOWN, std::memory_order_relaxed);
+    }
 }
 
-void ArrayOfListeners::init(JNIEnv *env, jobject array) {
-    if (!mirrorObject) {
-        jclass arrayOfListenersClass = env->FindClass(arrayOfListenersClassName);
-        listenerHoldersField = env->GetFieldID(arrayOfListenersClass, listenerHoldersFieldName, listenerHoldersFieldSignature);
+AllocationClassFilter::~AllocationClassFilter() {
+    JNIEnv *env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK) {
+        return;
+    }
+    for (jclass klass : trackedClasses) {
+        env->DeleteGlobalRef(klass);
+    }
+}
+
+bool AllocationClassFilter::accepts(JNIEnv *env, jclass klass, jint id) {
+    bool isCached = id > 0 && id <= MAX_CACHED_CLASS_ID;
+    if (isCached) {
+        uint8_t decision = decisions[id - 1].load(std::memory_order_relaxed);
+        if (decision != UNKNOWN) {
+            return decision == ACCEPTED;
+        }
+    }
+
+    bool accepted = false;
+    for (jclass trackedClass : trackedClasses) {
+        if (env->IsAssignableFrom(klass, trackedClass)) {
+            accepted = true;
+            break;
+        }
+    }
+    if (isCached) {
+        decisions[id - 1].store(accepted ? ACCEPTED : REJECTED, std::memory_order_relaxed);
+    }
+    return accepted;
+}
+
+ListenersSnapshot::ListenersSnapshot(JNIEnv *env, jobjectArray holders, jobjectArray trackedClasses) :
+    holders(reinterpret_cast<jobjectArray>(env->NewGlobalRef(holders))),
+    filter(trackedClasses == nullptr ? nullptr : new AllocationClassFilter(env, trackedClasses)) {
+    env->GetJavaVM(&vm);
+}
+
+ListenersSnapshot::~ListenersSnapshot() {
+    JNIEnv *env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) == JNI_OK) {
+        env->DeleteGlobalRef(holders);
+    }
+}
+
+ArrayOfListeners::ArrayOfListeners() : samples(SAMPLES_BUFFER_CAPACITY), droppedSamples(0) {
+
+}
+
+void ArrayOfListeners::init(jvmtiEnv *jvmti, JNIEnv *env) {
+    if (!notificationMethod) {
         jclass listenerHolderClass = env->FindClass(listenerHolderClassName);
         notificationMethod = env->GetMethodID(listenerHolderClass, notificationMethodName, notificationMethodSignature);
-        mirrorObject = env->NewGlobalRef(array);
-    } else {
-        env->DeleteGlobalRef(mirrorObject);
-        mirrorObject = env->NewGlobalRef(array);
+        threadClass = reinterpret_cast<jclass>(env->NewGlobalRef(env->FindClass("java/lang/Thread")));
+        classClass = reinterpret_cast<jclass>(env->NewGlobalRef(env->FindClass("java/lang/Class")));
+        objectClass = reinterpret_cast<jclass>(env->NewGlobalRef(env->FindClass("java/lang/Object")));
+        jvmtiError err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_THREAD_END, nullptr);
+        if (err != JVMTI_ERROR_NONE) {
+            handleError(jvmti, err, "Could not enable thread end events");
+        }
+        err = startDeliveryThread(jvmti, env);
+        if (err != JVMTI_ERROR_NONE) {
+            handleError(jvmti, err, "Could not start allocation listeners thread");
+        }
     }
 }
 
-void ArrayOfListeners::notifyAll(JNIEnv *env, jthread thread, jobject object, jclass klass, jlong size) const {
-    if (!mirrorObject) {
+void ArrayOfListeners::onAllocation(JNIEnv *env, jthread thread, jobject object, jclass klass, jint classId, jlong size) {
+    if (isDeliveryThread) {
+        return;
+    }
+
+    std::shared_ptr<ListenersSnapshot> snapshot = std::atomic_load(&listeners);
+    if (!snapshot || (snapshot->filter && !snapshot->filter->accepts(env, klass, classId))) {
+        return;
+    }
+
+    size_t position;
+    if (!samples.tryClaim(position)) {
+        droppedSamples.fetch_add(1, std::memory_order_relaxed);
         return;
     }
 
-    auto listenerHolders = reinterpret_cast<jobjectArray>(
-            env->GetObjectField(mirrorObject, listenerHoldersField)
-    );
+    if (currentThreadReference == nullptr) {
+        currentThreadReference = env->NewGlobalRef(thread);
+    }
+    samples.publish(position, AllocationSample{currentThreadReference, env->NewGlobalRef(object), size});
+    if (samples.size() >= MAX_BATCH_SIZE) {
+        deliveryCondition.notify_one();
+    }
+}
+
+void ArrayOfListeners::onThreadEnd() {
+    if (currentThreadReference == nullptr) {
+        return;
+    }
+
+    // Samples of this thread may still be queued, so the reference is deleted after they are delivered
+    std::lock_guard<std::mutex> lock(endedThreadsMutex);
+    endedThreads.push_back(currentThreadReference);
+    currentThreadReference = nullptr;
+}
+
+void ArrayOfListeners::update(JNIEnv *env, jobjectArray holders, jobjectArray trackedClasses) {
+    std::shared_ptr<ListenersSnapshot> snapshot;
+    if (notificationMethod && holders != nullptr && env->GetArrayLength(holders) > 0) {
+        snapshot = std::make_shared<ListenersSnapshot>(env, holders, trackedClasses);
+    }
+    std::atomic_store(&listeners, snapshot);
+}
+
+bool ArrayOfListeners::hasListeners() const {
+    return std::atomic_load(&listeners) != nullptr;
+}
+
+jvmtiError ArrayOfListeners::startDeliveryThread(jvmtiEnv *jvmti, JNIEnv *env) {
+    jmethodID constructor = env->GetMethodID(threadClass, "<init>", "(Ljava/lang/String;)V");
+    jobject thread = env->NewObject(threadClass, constructor, env->NewStringUTF(deliveryThreadName));
+    if (thread == nullptr) {
+        env->ExceptionClear();
+        return JVMTI_ERROR_OUT_OF_MEMORY;
+    }
+    return jvmti->RunAgentThread(thread, deliverSamples, this, JVMTI_THREAD_NORM_PRIORITY);
+}
+
+void JNICALL ArrayOfListeners::deliverSamples(jvmtiEnv *jvmti, JNIEnv *env, void *arg) {
+    isDeliveryThread = true;
+    auto *listeners = reinterpret_cast<ArrayOfListeners *>(arg);
+    std::vector<AllocationSample> batch;
+    batch.reserve(MAX_BATCH_SIZE);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(listeners->deliveryMutex);
+            listeners->deliveryCondition.wait_for(lock, DELIVERY_PERIOD);
+        }
+
+        // Threads that ended before this point published all their samples already
+        std::vector<jthread> endedThreads;
+        {
+            std::lock_guard<std::mutex> lock(listeners->endedThreadsMutex);
+            endedThreads.swap(listeners->endedThreads);
+        }
+
+        AllocationSample sample{};
+        while (listeners->samples.tryPop(sample)) {
+            batch.push_back(sample);
+            if (batch.size() == MAX_BATCH_SIZE) {
+                listeners->notifyAll(env, batch);
+            }
+        }
+        if (!batch.empty()) {
+            listeners->notifyAll(env, batch);
+        }
+        for (jthread thread : endedThreads) {
+            env->DeleteGlobalRef(thread);
+        }
+
+        jlong dropped = listeners->droppedSamples.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            logger::debug("allocation samples buffer is full, some samples were dropped");
+        }
+    }
+}
+
+void ArrayOfListeners::notifyAll(JNIEnv *env, std::vector<AllocationSample> &samples) const {
+    auto size = static_cast<jsize>(samples.size());
+    std::shared_ptr<ListenersSnapshot> snapshot = std::atomic_load(&listeners);
+    if (snapshot && env->PushLocalFrame(5) == JNI_OK) {
+        jobjectArray threads = env->NewObjectArray(size, threadClass, nullptr);
+        jobjectArray objects = env->NewObjectArray(size, objectClass, nullptr);
+        jobjectArray classes = env->NewObjectArray(size, classClass, nullptr);
+        jlongArray sizes = env->NewLongArray(size);
+        if (threads && objects && classes && sizes) {
+            for (jsize i = 0; i < size; i++) {
+                jclass klass = env->GetObjectClass(samples[i].object);
+                env->SetObjectArrayElement(threads, i, samples[i].thread);
+                env->SetObjectArrayElement(objects, i, samples[i].object);
+                env->SetObjectArrayElement(classes, i, klass);
+                env->SetLongArrayRegion(sizes, i, 1, &samples[i].size);
+                env->DeleteLocalRef(klass);
+            }
+
+            for (jsize i = 0; i < env->GetArrayLength(snapshot->holders); i++) {
+                jobject listenerHolder = env->GetObjectArrayElement(snapshot->holders, i);
+                env->CallVoidMethod(listenerHolder, notificationMethod, threads, objects, classes, sizes);
+                if (env->ExceptionCheck()) {
+                    env->ExceptionDescribe();
+                    env->ExceptionClear();
+                }
+                env->DeleteLocalRef(listenerHolder);
+            }
+        } else {
+            env->ExceptionClear();
+        }
+        env->PopLocalFrame(nullptr);
+    }
 
-    for (jsize i = 0; i < env->GetArrayLength(listenerHolders); i++) {
-        jobject listenerHolder = env->GetObjectArrayElement(listenerHolders, i);
-        env->CallVoidMethod(listenerHolder, notificationMethod, thread, object, klass, size);
+    for (const AllocationSample &sample : samples) {
+        env->DeleteGlobalRef(sample.object);
     }
+    samples.clear();
 }
@@ -3,35 +3,170 @@
 #ifndef MEMORY_AGENT_ALLOCATION_SAMPLING_H
 #define MEMORY_AGENT_ALLOCATION_SAMPLING_H
 
+#include <atomic>
+#include <condition_variable>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "jni.h"
 #include "jvmti.h"
 
+// The object reference is global, so samples outlive the allocation callback. The thread reference
+// is cached per thread and released after the thread ends, the class is taken from the object.
+struct AllocationSample {
+    jthread thread;
+    jobject object;
+    jlong size;
+};
+
+/*
+ * Bounded lock-free queue of allocation samples with many producers and a single consumer.
+ * A producer claims a cell by advancing the enqueue position and publishes the sample
+ * by bumping the cell sequence, so allocating threads never block. When the buffer is full
+ * no cell is claimed, so the sample is rejected before any references are created for it.
+ */
+class AllocationSamplesBuffer {
+public:
+    explicit AllocationSamplesBuffer(size_t capacity);
+
+    bool tryClaim(size_t &position);
+    void publish(size_t position, const AllocationSample &sample);
+    bool tryPop(AllocationSample &sample);
+    size_t size() const;
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        AllocationSample sample;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    const size_t mask;
+    alignas(64) std::atomic<size_t> enqueuePosition;
+    alignas(64) std::atomic<size_t> dequeuePosition;
+};
+
+/*
+ * Adjusts the heap sampling interval so the observed number of samples per second approaches
+ * the target one. The rate is measured over adjustment periods, and a burst that reaches twice
+ * the target ends the period early. Every step changes the interval at most four times and keeps
+ * it within the configured bounds. Aggregated sizes are weighted by the interval they were sampled
+ * with, so they estimate allocated bytes whatever the interval was.
+ */
+class SamplingIntervalController {
+public:
+    static const jint DEFAULT_INTERVAL = 512 * 1024;
+
+    // The interval set by the user disables the adaptive mode
+    void setInterval(jint interval);
+
+    // A target rate of 0 disables the adaptive mode
+    void setTarget(jlong samplesPerSecond, jint minInterval, jint maxInterval);
+
+    void onSample(jvmtiEnv *jvmti);
+
+    // Unbiased estimate of bytes allocated per sample of an object of the given size
+    jlong estimateAllocatedBytes(jlong size) const;
+
+private:
+    static jlong nowNanos();
+
+    std::atomic<jint> interval{DEFAULT_INTERVAL};
+    std::atomic<jlong> targetRate{0};
+    std::atomic<jint> minInterval{0};
+    std::atomic<jint> maxInterval{0};
+    std::atomic<jlong> periodSamples{0};
+    std::atomic<jlong> periodStart{0};
+};
+
+extern SamplingIntervalController samplingIntervalController;
+
+/*
+ * Classes tracked by at least one listener, subclasses included. Decisions are cached
+ * per class id of the allocation sites table, so samples of other classes are dropped
+ * with a single load before any Java code is called.
+ */
+class AllocationClassFilter {
+public:
+    AllocationClassFilter(JNIEnv *env, jobjectArray classes);
+    ~AllocationClassFilter();
+
+    bool accepts(JNIEnv *env, jclass klass, jint classId);
+
+private:
+    enum Decision : uint8_t {
+        UNKNOWN = 0,
+        ACCEPTED = 1,
+        REJECTED = 2
+    };
+
+    JavaVM *vm = nullptr;
+    std::vector<jclass> trackedClasses;
+    std::unique_ptr<std::atomic<uint8_t>[]> decisions;
+};
+
+// Immutable set of listener holders with their class filter, replaced as a whole on every change
+struct ListenersSnapshot {
+    ListenersSnapshot(JNIEnv *env, jobjectArray holders, jobjectArray trackedClasses);
+    ~ListenersSnapshot();
+
+    JavaVM *vm = nullptr;
+    jobjectArray holders;
+    std::unique_ptr<AllocationClassFilter> filter;
+};
+
+/*
+ * Java listeners of sampled allocations. Allocating threads only put samples into
+ * the buffer, an agent thread delivers them to every listener holder in batches.
+ */
 class ArrayOfListeners {
 private:
     static const char *listenerHolderClassName;
     static const char *notificationMethodName;
     static const char *notificationMethodSignature;
-    static const char *arrayOfListenersClassName;
-    static const char *listenerHoldersFieldName;
-    static const char *listenerHoldersFieldSignature;
+    static const char *deliveryThreadName;
 
 public:
-    void init(JNIEnv *env, jobject array);
-    void notifyAll(JNIEnv *env, jthread thread, jobject object, jclass klass, jlong size) const;
+    ArrayOfListeners();
+
+    void init(jvmtiEnv *jvmti, JNIEnv *env);
+    void onAllocation(JNIEnv *env, jthread thread, jobject object, jclass klass, jint classId, jlong size);
+
+    void onThreadEnd();
+
+    // Null classes mean that some listener tracks all of them
+    void update(JNIEnv *env, jobjectArray holders, jobjectArray trackedClasses);
+
+    bool hasListeners() const;
+
+private:
+    jvmtiError startDeliveryThread(jvmtiEnv *jvmti, JNIEnv *env);
+    static void JNICALL deliverSamples(jvmtiEnv *jvmti, JNIEnv *env, void *arg);
+    void notifyAll(JNIEnv *env, std::vector<AllocationSample> &samples) const;
 
 private:
-    jobject mirrorObject = nullptr;
     jmethodID notificationMethod = nullptr;
-    jfieldID listenerHoldersField = nullptr;
+    jclass threadClass = nullptr;
+    jclass classClass = nullptr;
+    jclass objectClass = nullptr;
+
+    std::shared_ptr<ListenersSnapshot> listeners;
+    AllocationSamplesBuffer samples;
+    std::atomic<jlong> droppedSamples;
+    std::mutex deliveryMutex;
+    std::condition_variable deliveryCondition;
+    std::mutex endedThreadsMutex;
+    std::vector<jthread> endedThreads;
 };
 
-extern ArrayOfListeners arrayOfListeners;
+extern ArrayOfListeners &arrayOfListeners;
 
 extern "C" JNIEXPORT void JNICALL SampledObjectAlloc(jvmtiEnv *jvmti, JNIEnv *env, jthread thread,
                                                      jobject object, jclass klass, jlong size);
 
+extern "C" JNIEXPORT void JNICALL SamplingThreadEnd(jvmtiEnv *jvmti, JNIEnv *env, jthread thread);
+
 
 #endif //MEMORY_AGENT_ALLOCATION_SAMPLING_H
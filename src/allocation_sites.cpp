@@ -0,0 +1,435 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include "allocation_sites.h"
+#include "utils.h"
+
+// Event callbacks and agent threads keep using it until the VM exits, so it is never destroyed
+AllocationSites &allocationSites = *new AllocationSites();
+
+namespace {
+    const jint MAX_STACK_DEPTH = 1024;
+
+    thread_local std::vector<jvmtiFrameInfo> framesBuffer;
+
+    // Counters of an exiting thread are added to the retired ones
+    struct ThreadClassCountersHandle {
+        ~ThreadClassCountersHandle() {
+            if (counters) {
+                allocationSites.retireThreadCounters(counters);
+            }
+        }
+
+        std::shared_ptr<AllocationSites::ThreadClassCounters> counters;
+    };
+
+    thread_local ThreadClassCountersHandle threadClassCounters;
+
+    std::string signatureToName(const char *signature) {
+        std::string name(signature);
+        if (name.size() > 2 && name.front() == 'L' && name.back() == ';') {
+            name = name.substr(1, name.size() - 2);
+        }
+        for (char &c : name) {
+            if (c == '/') c = '.';
+        }
+        return name;
+    }
+}
+
+size_t AllocationSites::StackHash::operator()(const std::vector<jmethodID> &stack) const {
+    size_t hash = stack.size();
+    for (jmethodID method : stack) {
+        hash ^= std::hash<jmethodID>()(method) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+extern "C" JNIEXPORT void JNICALL SampledObjectFree(jvmtiEnv *jvmti, jlong tag) {
+    allocationSites.onObjectFree(tag);
+}
+
+jvmtiError AllocationSites::init(JavaVM *vm) {
+    if (jvmti != nullptr) {
+        return JVMTI_ERROR_NONE;
+    }
+
+    jvmtiEnv *sitesEnv = nullptr;
+    jint result = vm->GetEnv(reinterpret_cast<void **>(&sitesEnv), JVMTI_VERSION_1_0);
+    if (result != JNI_OK || sitesEnv == nullptr) {
+        return JVMTI_ERROR_NOT_AVAILABLE;
+    }
+
+    jvmtiCapabilities capabilities;
+    std::memset(&capabilities, 0, sizeof(jvmtiCapabilities));
+    capabilities.can_tag_objects = 1;
+    jvmtiError err = sitesEnv->AddCapabilities(&capabilities);
+    if (!isOk(err)) return err;
+
+    jvmti = sitesEnv;
+    // Live objects tracking is optional, sites are aggregated without it
+    initLiveObjectsEnv(vm);
+    return JVMTI_ERROR_NONE;
+}
+
+jvmtiError AllocationSites::initLiveObjectsEnv(JavaVM *vm) {
+    jvmtiEnv *liveEnv = nullptr;
+    jint result = vm->GetEnv(reinterpret_cast<void **>(&liveEnv), JVMTI_VERSION_1_0);
+    if (result != JNI_OK || liveEnv == nullptr) {
+        return JVMTI_ERROR_NOT_AVAILABLE;
+    }
+
+    // Class tags of the sites env would produce ObjectFree events on class unloading, so sampled objects have their own env
+    jvmtiCapabilities capabilities;
+    std::memset(&capabilities, 0, sizeof(jvmtiCapabilities));
+    capabilities.can_tag_objects = 1;
+    capabilities.can_generate_object_free_events = 1;
+    jvmtiError err = liveEnv->AddCapabilities(&capabilities);
+    if (!isOk(err)) return err;
+
+    jvmtiEventCallbacks callbacks;
+    std::memset(&callbacks, 0, sizeof(jvmtiEventCallbacks));
+    callbacks.ObjectFree = SampledObjectFree;
+    err = liveEnv->SetEventCallbacks(&callbacks, sizeof(jvmtiEventCallbacks));
+    if (!isOk(err)) return err;
+
+    err = liveEnv->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_OBJECT_FREE, nullptr);
+    if (!isOk(err)) return err;
+
+    liveObjectsJvmti = liveEnv;
+    return JVMTI_ERROR_NONE;
+}
+
+void AllocationSites::setStackDepth(jint depth) {
+    stackDepth.store(std::max(0, std::min(depth, MAX_STACK_DEPTH)), std::memory_order_relaxed);
+}
+
+bool AllocationSites::setLiveObjectsTracking(bool enabled) {
+    if (liveObjectsJvmti == nullptr) {
+        return false;
+    }
+    trackLiveObjects.store(enabled, std::memory_order_relaxed);
+    return true;
+}
+
+void AllocationSites::setClassCounting(bool enabled) {
+    countClasses.store(enabled, std::memory_order_relaxed);
+}
+
+void AllocationSites::setSitesCollection(bool enabled) {
+    collectSites.store(enabled, std::memory_order_relaxed);
+}
+
+bool AllocationSites::isActive() const {
+    return stackDepth.load(std::memory_order_relaxed) > 0 ||
+           collectSites.load(std::memory_order_relaxed) ||
+           trackLiveObjects.load(std::memory_order_relaxed) ||
+           countClasses.load(std::memory_order_relaxed);
+}
+
+void AllocationSites::onAllocation(JNIEnv *env, jobject object, jint classId, jlong size) {
+    jint depth = stackDepth.load(std::memory_order_relaxed);
+    bool trackObject = trackLiveObjects.load(std::memory_order_relaxed);
+    bool countClass = countClasses.load(std::memory_order_relaxed);
+    bool countSite = depth > 0 || collectSites.load(std::memory_order_relaxed);
+    if ((!countSite && !trackObject && !countClass) || classId == 0) {
+        return;
+    }
+
+    // An action may suspend this thread inside any JNI or JVMTI call, so none of them are made under the lock
+    jint framesCount = 0;
+    if (depth > 0) {
+        framesBuffer.resize(static_cast<size_t>(depth));
+        jvmtiError err = jvmti->GetStackTrace(nullptr, 0, depth, framesBuffer.data(), &framesCount);
+        if (!isOk(err)) return;
+    }
+
+    if (countClass) {
+        countClassAllocation(classId, size);
+    }
+    if (!countSite && !trackObject) return;
+
+    std::vector<jmethodID> stack(static_cast<size_t>(framesCount));
+    for (jint i = 0; i < framesCount; i++) {
+        stack[i] = framesBuffer[i].method;
+    }
+
+    jlong tag = trackObject ? ++lastLiveObjectTag : 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t site = (static_cast<uint64_t>(internStack(stack)) << 32) | static_cast<uint32_t>(classId);
+        if (countSite) {
+            Counters &counters = countersBySite[site];
+            counters.count++;
+            counters.size += size;
+        }
+        if (trackObject) {
+            liveObjects[tag] = LiveObject{site, size};
+        }
+    }
+
+    // The object can't be freed before the event callback returns, so it is tagged after being registered
+    if (trackObject && !isOk(liveObjectsJvmti->SetTag(object, tag))) {
+        onObjectFree(tag);
+    }
+}
+
+jint AllocationSites::getClassId(JNIEnv *env, jclass klass) {
+    return jvmti == nullptr ? 0 : registerClass(env, klass);
+}
+
+void AllocationSites::countClassAllocation(jint classId, jlong size) {
+    std::shared_ptr<ThreadClassCounters> &counters = threadClassCounters.counters;
+    if (!counters) {
+        counters = std::make_shared<ThreadClassCounters>();
+        std::lock_guard<std::mutex> lock(mutex);
+        threadCounters.push_back(counters);
+    }
+
+    std::lock_guard<std::mutex> lock(counters->mutex);
+    if (counters->byClass.size() < static_cast<size_t>(classId)) {
+        counters->byClass.resize(static_cast<size_t>(classId), Counters{0, 0});
+    }
+    Counters &classCounters = counters->byClass[classId - 1];
+    classCounters.count++;
+    classCounters.size += size;
+}
+
+void AllocationSites::retireThreadCounters(const std::shared_ptr<ThreadClassCounters> &counters) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::lock_guard<std::mutex> countersLock(counters->mutex);
+    if (retiredThreadCounters.size() < counters->byClass.size()) {
+        retiredThreadCounters.resize(counters->byClass.size(), Counters{0, 0});
+    }
+    for (size_t i = 0; i < counters->byClass.size(); i++) {
+        retiredThreadCounters[i].count += counters->byClass[i].count;
+        retiredThreadCounters[i].size += counters->byClass[i].size;
+    }
+    threadCounters.erase(std::remove(threadCounters.begin(), threadCounters.end(), counters), threadCounters.end());
+}
+
+jobjectArray AllocationSites::getClassCountersDelta(JNIEnv *env) {
+    std::vector<jweak> deltaClasses;
+    std::vector<Counters> deltas;
+    jlong elapsedNanos;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Counters> totals(retiredThreadCounters);
+        totals.resize(classes.size(), Counters{0, 0});
+        for (auto &counters : threadCounters) {
+            std::lock_guard<std::mutex> countersLock(counters->mutex);
+            for (size_t i = 0; i < counters->byClass.size(); i++) {
+                totals[i].count += counters->byClass[i].count;
+                totals[i].size += counters->byClass[i].size;
+            }
+        }
+
+        lastReadCounters.resize(totals.size(), Counters{0, 0});
+        for (size_t i = 0; i < totals.size(); i++) {
+            Counters delta{totals[i].count - lastReadCounters[i].count, totals[i].size - lastReadCounters[i].size};
+            if (delta.count != 0) {
+                deltaClasses.push_back(classes[i]);
+                deltas.push_back(delta);
+            }
+        }
+        lastReadCounters.swap(totals);
+
+        auto now = std::chrono::steady_clock::now();
+        elapsedNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastReadTime).count();
+        lastReadTime = now;
+    }
+
+    std::map<std::string, Counters> deltasByName;
+    for (size_t i = 0; i < deltaClasses.size(); i++) {
+        bool isUnloaded = env->IsSameObject(deltaClasses[i], nullptr);
+        Counters &counters = deltasByName[isUnloaded ? "<unloaded>" : getClassName(reinterpret_cast<jclass>(deltaClasses[i]))];
+        counters.count += deltas[i].count;
+        counters.size += deltas[i].size;
+    }
+
+    jobjectArray names = env->NewObjectArray(static_cast<jsize>(deltasByName.size()), env->FindClass("java/lang/String"), nullptr);
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+    for (auto &entry : deltasByName) {
+        jstring name = env->NewStringUTF(entry.first.c_str());
+        env->SetObjectArrayElement(names, static_cast<jsize>(counts.size()), name);
+        env->DeleteLocalRef(name);
+        counts.push_back(entry.second.count);
+        sizes.push_back(entry.second.size);
+    }
+
+    jobjectArray result = env->NewObjectArray(4, env->FindClass("java/lang/Object"), nullptr);
+    env->SetObjectArrayElement(result, 0, names);
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, counts));
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, sizes));
+    env->SetObjectArrayElement(result, 3, toJavaArray(env, elapsedNanos));
+    return result;
+}
+
+void AllocationSites::onObjectFree(jlong tag) {
+    std::lock_guard<std::mutex> lock(mutex);
+    liveObjects.erase(tag);
+}
+
+jint AllocationSites::internStack(std::vector<jmethodID> &stack) {
+    auto it = stackToId.find(stack);
+    if (it == stackToId.end()) {
+        it = stackToId.emplace(std::move(stack), static_cast<jint>(stacks.size())).first;
+        stacks.push_back(&it->first);
+    }
+    return it->second;
+}
+
+jint AllocationSites::registerClass(JNIEnv *env, jclass klass) {
+    jlong tag;
+    jvmtiError err = jvmti->GetTag(klass, &tag);
+    if (!isOk(err)) return 0;
+    if (tag != 0) return static_cast<jint>(tag);
+
+    // Racing threads may register a class twice, its sites are merged on export by the class name
+    jweak weakClass = env->NewWeakGlobalRef(klass);
+    jint id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        classes.push_back(weakClass);
+        id = static_cast<jint>(classes.size());
+    }
+    jvmti->SetTag(klass, id);
+    return id;
+}
+
+jobjectArray AllocationSites::getFoldedStacks(JNIEnv *env) {
+    std::unordered_map<uint64_t, Counters> sites = getSiteCounters();
+    return exportSites(env, sites, true);
+}
+
+std::unordered_map<uint64_t, AllocationSites::Counters> AllocationSites::getSiteCounters(uint64_t *generation) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation != nullptr) {
+        *generation = countersGeneration;
+    }
+    return countersBySite;
+}
+
+std::vector<jmethodID> AllocationSites::getStack(jint stackId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return *stacks[stackId];
+}
+
+std::string AllocationSites::getClassName(JNIEnv *env, jint classId) {
+    jweak klass;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        klass = classes[classId - 1];
+    }
+    if (env->IsSameObject(klass, nullptr)) {
+        return "<unloaded>";
+    }
+    return getClassName(reinterpret_cast<jclass>(klass));
+}
+
+jobjectArray AllocationSites::getLiveObjects(JNIEnv *env, bool bySite) {
+    std::unordered_map<uint64_t, Counters> sites;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &entry : liveObjects) {
+            Counters &counters = sites[entry.second.site];
+            counters.count++;
+            counters.size += entry.second.size;
+        }
+    }
+    return exportSites(env, sites, bySite);
+}
+
+jobjectArray AllocationSites::exportSites(JNIEnv *env, const std::unordered_map<uint64_t, Counters> &sites, bool withStacks) {
+    std::vector<std::vector<jmethodID>> sitesStacks;
+    std::vector<jweak> sitesClasses;
+    std::vector<Counters> sitesCounters;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &entry : sites) {
+            sitesStacks.push_back(withStacks ? *stacks[entry.first >> 32] : std::vector<jmethodID>());
+            sitesClasses.push_back(classes[(entry.first & 0xFFFFFFFFu) - 1]);
+            sitesCounters.push_back(entry.second);
+        }
+    }
+
+    std::unordered_map<jmethodID, std::string> methodNames;
+    std::unordered_map<jweak, std::string> classNames;
+    std::map<std::string, Counters> foldedStacks;
+    for (size_t i = 0; i < sitesStacks.size(); i++) {
+        std::string folded;
+        for (auto it = sitesStacks[i].rbegin(); it != sitesStacks[i].rend(); ++it) {
+            auto nameIt = methodNames.find(*it);
+            if (nameIt == methodNames.end()) {
+                nameIt = methodNames.emplace(*it, getMethodName(*it)).first;
+            }
+            folded += nameIt->second;
+            folded += ';';
+        }
+
+        auto classIt = classNames.find(sitesClasses[i]);
+        if (classIt == classNames.end()) {
+            bool isUnloaded = env->IsSameObject(sitesClasses[i], nullptr);
+            classIt = classNames.emplace(sitesClasses[i], isUnloaded ? "<unloaded>" : getClassName(reinterpret_cast<jclass>(sitesClasses[i]))).first;
+        }
+        folded += classIt->second;
+
+        Counters &counters = foldedStacks[folded];
+        counters.count += sitesCounters[i].count;
+        counters.size += sitesCounters[i].size;
+    }
+
+    jobjectArray stacksArray = env->NewObjectArray(static_cast<jsize>(foldedStacks.size()), env->FindClass("java/lang/String"), nullptr);
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+    for (auto &entry : foldedStacks) {
+        jstring stack = env->NewStringUTF(entry.first.c_str());
+        env->SetObjectArrayElement(stacksArray, static_cast<jsize>(counts.size()), stack);
+        env->DeleteLocalRef(stack);
+        counts.push_back(entry.second.count);
+        sizes.push_back(entry.second.size);
+    }
+
+    jobjectArray result = env->NewObjectArray(3, env->FindClass("java/lang/Object"), nullptr);
+    env->SetObjectArrayElement(result, 0, stacksArray);
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, counts));
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, sizes));
+    return result;
+}
+
+// Interned stacks are kept, live objects still refer to them
+void AllocationSites::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    countersBySite.clear();
+    countersGeneration++;
+}
+
+std::string AllocationSites::getMethodName(jmethodID method) {
+    std::string name = "<unknown>";
+    jclass declaringClass;
+    if (isOk(jvmti->GetMethodDeclaringClass(method, &declaringClass))) {
+        name = getClassName(declaringClass);
+    }
+
+    char *methodName;
+    if (isOk(jvmti->GetMethodName(method, &methodName, nullptr, nullptr))) {
+        name += '.';
+        name += methodName;
+        jvmti->Deallocate(reinterpret_cast<unsigned char *>(methodName));
+    }
+    return name;
+}
+
+std::string AllocationSites::getClassName(jclass klass) {
+    char *signature;
+    if (!isOk(jvmti->GetClassSignature(klass, &signature, nullptr))) {
+        return "<unloaded>";
+    }
+
+    std::string name = signatureToName(signature);
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(signature));
+    return name;
+}
@@ -0,0 +1,125 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_ALLOCATION_SITES_H
+#define MEMORY_AGENT_ALLOCATION_SITES_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "jni.h"
+#include "jvmti.h"
+
+/*
+ * Bytes and counts of sampled allocations aggregated per allocation stack and allocated class.
+ * Stacks are captured natively on sampled allocations and interned as sequences of methods,
+ * allocated classes are tagged with their ids in a dedicated jvmtiEnv like in the class index.
+ * Method and class names are resolved only when the stacks are exported in the folded format.
+ * Sampled objects can also be tagged in another jvmtiEnv, where ObjectFree events retire them,
+ * so the live part of sampled allocations is known at any moment without a heap walk.
+ * Per class counters are kept by every allocating thread and merged only when they are read.
+ */
+class AllocationSites {
+public:
+    struct Counters {
+        jlong count;
+        jlong size;
+    };
+
+    // Counters of one thread indexed by class ids, locked by the owner thread and by readers only
+    struct ThreadClassCounters {
+        std::mutex mutex;
+        std::vector<Counters> byClass;
+    };
+
+    jvmtiError init(JavaVM *vm);
+
+    // Depth 0 disables capturing of allocation stacks
+    void setStackDepth(jint depth);
+
+    bool setLiveObjectsTracking(bool enabled);
+
+    void setClassCounting(bool enabled);
+
+    // Aggregates sites even when stacks are not captured, they are exported with empty stacks then
+    void setSitesCollection(bool enabled);
+
+    // Whether sampled allocations are consumed by any of the above
+    bool isActive() const;
+
+    // Site keys hold the stack id in the high and the class id in the low 32 bits.
+    // The generation changes whenever the counters are cleared.
+    std::unordered_map<uint64_t, Counters> getSiteCounters(uint64_t *generation = nullptr);
+
+    std::vector<jmethodID> getStack(jint stackId);
+
+    std::string getClassName(JNIEnv *env, jint classId);
+
+    std::string getMethodName(jmethodID method);
+
+    void onAllocation(JNIEnv *env, jobject object, jint classId, jlong size);
+
+    // Returns the id of the class in the sites table or 0 if classes can't be tagged
+    jint getClassId(JNIEnv *env, jclass klass);
+
+    void onObjectFree(jlong tag);
+
+    // Returns folded stacks from the outermost frame to the allocated class with their counts and sizes
+    jobjectArray getFoldedStacks(JNIEnv *env);
+
+    // Returns counts and sizes of live sampled objects per folded stack or per class only
+    jobjectArray getLiveObjects(JNIEnv *env, bool bySite);
+
+    // Returns counts and sizes of sampled allocations per class since the previous call and its time in nanoseconds
+    jobjectArray getClassCountersDelta(JNIEnv *env);
+
+    void retireThreadCounters(const std::shared_ptr<ThreadClassCounters> &counters);
+
+    void clear();
+
+private:
+    struct LiveObject {
+        uint64_t site;
+        jlong size;
+    };
+
+    struct StackHash {
+        size_t operator()(const std::vector<jmethodID> &stack) const;
+    };
+
+    jvmtiError initLiveObjectsEnv(JavaVM *vm);
+    jint registerClass(JNIEnv *env, jclass klass);
+    void countClassAllocation(jint classId, jlong size);
+    jint internStack(std::vector<jmethodID> &stack);
+    jobjectArray exportSites(JNIEnv *env, const std::unordered_map<uint64_t, Counters> &sites, bool withStacks);
+    std::string getClassName(jclass klass);
+
+private:
+    jvmtiEnv *jvmti = nullptr;
+    jvmtiEnv *liveObjectsJvmti = nullptr;
+    std::atomic<jint> stackDepth{0};
+    std::atomic<bool> trackLiveObjects{false};
+    std::atomic<jlong> lastLiveObjectTag{0};
+    std::atomic<bool> countClasses{false};
+    std::atomic<bool> collectSites{false};
+    std::mutex mutex;
+    std::vector<jweak> classes;
+    std::unordered_map<std::vector<jmethodID>, jint, StackHash> stackToId;
+    std::vector<const std::vector<jmethodID> *> stacks;
+    std::unordered_map<uint64_t, Counters> countersBySite;
+    uint64_t countersGeneration = 0;
+    std::unordered_map<jlong, LiveObject> liveObjects;
+    std::vector<std::shared_ptr<ThreadClassCounters>> threadCounters;
+    std::vector<Counters> retiredThreadCounters;
+    std::vector<Counters> lastReadCounters;
+    std::chrono::steady_clock::time_point lastReadTime = std::chrono::steady_clock::now();
+};
+
+extern AllocationSites &allocationSites;
+
+extern "C" JNIEXPORT void JNICALL SampledObjectFree(jvmtiEnv *jvmti, jlong tag);
+
+#endif //MEMORY_AGENT_ALLOCATION_SITES_H
@@ -0,0 +1,359 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <algorithm>
+#include <cstring>
+#include "class_index.h"
+#include "utils.h"
+
+ClassIndex classIndex;
+
+extern "C" JNIEXPORT void JNICALL ClassPrepare(jvmtiEnv *jvmti, JNIEnv *env, jthread thread, jclass klass) {
+    classIndex.onClassPrepare(env, klass);
+}
+
+static bool isFillerClass(const char *signature) {
+    // jdk/internal/vm/FillerArray objects are used to mark dead heap areas
+    // see https://bugs.openjdk.org/browse/JDK-8284435
+    // These objects must not be accessible, so they are facultative for analysis.
+    //
+    // However, these objects are invisible for consecutive jvmti->IterateThroughHeap calls.
+    //
+    // Simple test: tag all objects with IterateThroughHeap, then remove tags with another IterateThroughHeap
+    // call. There will be 3 tags left.
+    //
+    // see https://youtrack.jetbrains.com/issue/IDEA-330128
+    return strcmp(signature, "Ljdk/internal/vm/FillerArray;") == 0
+           || strcmp(signature, "Ljdk/internal/vm/FillerObject;") == 0
+           || strcmp(signature, "[Ljdk/internal/vm/FillerElement;") == 0;
+}
+
+jvmtiError ClassIndex::init(JavaVM *vm) {
+    if (jvmti != nullptr) {
+        return JVMTI_ERROR_NONE;
+    }
+
+    jvmtiEnv *classesEnv = nullptr;
+    jint result = vm->GetEnv(reinterpret_cast<void **>(&classesEnv), JVMTI_VERSION_1_0);
+    if (result != JNI_OK || classesEnv == nullptr) {
+        return JVMTI_ERROR_NOT_AVAILABLE;
+    }
+
+    jvmtiCapabilities capabilities;
+    std::memset(&capabilities, 0, sizeof(jvmtiCapabilities));
+    capabilities.can_tag_objects = 1;
+    jvmtiError err = classesEnv->AddCapabilities(&capabilities);
+    if (!isOk(err)) return err;
+
+    jvmtiEventCallbacks callbacks;
+    std::memset(&callbacks, 0, sizeof(jvmtiEventCallbacks));
+    callbacks.ClassPrepare = ClassPrepare;
+    err = classesEnv->SetEventCallbacks(&callbacks, sizeof(jvmtiEventCallbacks));
+    if (!isOk(err)) return err;
+
+    // Id 0 is reserved for classes that are not registered yet
+    classes.push_back(ClassInfo{nullptr, {}, {}, false, false});
+    jvmti = classesEnv;
+    return JVMTI_ERROR_NONE;
+}
+
+void ClassIndex::onClassPrepare(JNIEnv *env, jclass klass) {
+    // An action may suspend this thread inside any JNI or JVMTI call, so none of them are made under the lock
+    jweak preparedClass = env->NewWeakGlobalRef(klass);
+    std::lock_guard<std::mutex> lock(preparedClassesMutex);
+    preparedClasses.push_back(preparedClass);
+}
+
+jvmtiError ClassIndex::forEachSubtype(JNIEnv *env, jclass klass, const std::function<jvmtiError(jclass)> &callback) {
+    if (jvmti == nullptr) {
+        return JVMTI_ERROR_NOT_AVAILABLE;
+    }
+
+    // An action may suspend the thread that uses the index inside any JNI or JVMTI call,
+    // so other threads scan loaded classes instead of waiting for it
+    if (isBusy.exchange(true, std::memory_order_acquire)) {
+        return forEachAssignableLoadedClass(env, klass, callback);
+    }
+    std::vector<jclass> subtypes;
+    jvmtiError err = collectSubtypes(env, klass, subtypes);
+    isBusy.store(false, std::memory_order_release);
+
+    for (jclass subtype : subtypes) {
+        if (isOk(err)) {
+            err = callback(subtype);
+        }
+        env->DeleteLocalRef(subtype);
+    }
+    return err;
+}
+
+jvmtiError ClassIndex::collectSubtypes(JNIEnv *env, jclass klass, std::vector<jclass> &subtypes) {
+    jvmtiError err = synchronize(env);
+    if (!isOk(err)) return err;
+
+    if (env->IsSameObject(klass, objectClass)) {
+        return collectLoadedClasses(env, subtypes);
+    }
+
+    jint id;
+    err = registerClass(env, klass, id);
+    if (!isOk(err) || id == 0) return err;
+
+    if (canHaveArraySubtypes(env, klass, id)) {
+        err = registerLoadedClasses(env);
+        if (!isOk(err)) return err;
+    }
+
+    std::vector<bool> isSubtype(classes.size());
+    std::vector<jint> stack{id};
+    isSubtype[id] = true;
+    while (!stack.empty()) {
+        jint current = stack.back();
+        stack.pop_back();
+        for (jint subtype : classes[current].subtypes) {
+            if (!isSubtype[subtype]) {
+                isSubtype[subtype] = true;
+                stack.push_back(subtype);
+            }
+        }
+    }
+
+    // Covariance of arrays is not in the index, array classes are checked one by one when an array class is queried
+    bool checkArrays = classes[id].isArray;
+    auto classesCount = static_cast<jint>(classes.size());
+    for (jint i = 1; i < classesCount; i++) {
+        if (classes[i].klass == nullptr || classes[i].isFiller || (!isSubtype[i] && !(checkArrays && classes[i].isArray))) {
+            continue;
+        }
+
+        auto subtype = reinterpret_cast<jclass>(env->NewLocalRef(classes[i].klass));
+        if (subtype == nullptr) {
+            unregisterClass(env, i);
+        } else if (isSubtype[i] || env->IsAssignableFrom(subtype, klass)) {
+            subtypes.push_back(subtype);
+        } else {
+            env->DeleteLocalRef(subtype);
+        }
+    }
+    return err;
+}
+
+jvmtiError ClassIndex::collectLoadedClasses(JNIEnv *env, std::vector<jclass> &subtypes) {
+    jint count;
+    jclass *loadedClasses;
+    jvmtiError err = jvmti->GetLoadedClasses(&count, &loadedClasses);
+    if (!isOk(err)) return err;
+
+    // Ids registered during the pass belong to loaded classes, so only the older ones are checked
+    std::vector<bool> isLoaded(classes.size());
+    for (jint i = 0; i < count; i++) {
+        jint id = 0;
+        if (isOk(err)) {
+            err = registerClass(env, loadedClasses[i], id);
+        }
+        if (isOk(err) && id != 0) {
+            if (static_cast<size_t>(id) < isLoaded.size()) {
+                isLoaded[id] = true;
+            }
+            if (!classes[id].isFiller) {
+                subtypes.push_back(loadedClasses[i]);
+                continue;
+            }
+        }
+        env->DeleteLocalRef(loadedClasses[i]);
+    }
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(loadedClasses));
+    if (!isOk(err)) return err;
+
+    for (size_t i = 1; i < isLoaded.size(); i++) {
+        if (!isLoaded[i] && classes[i].klass != nullptr) {
+            unregisterClass(env, static_cast<jint>(i));
+        }
+    }
+    return err;
+}
+
+jvmtiError ClassIndex::forEachAssignableLoadedClass(JNIEnv *env, jclass klass, const std::function<jvmtiError(jclass)> &callback) {
+    jint count;
+    jclass *loadedClasses;
+    jvmtiError err = jvmti->GetLoadedClasses(&count, &loadedClasses);
+    if (!isOk(err)) return err;
+
+    for (jint i = 0; i < count; i++) {
+        if (isOk(err) && env->IsAssignableFrom(loadedClasses[i], klass)) {
+            char *signature;
+            err = jvmti->GetClassSignature(loadedClasses[i], &signature, nullptr);
+            if (isOk(err)) {
+                bool isFiller = isFillerClass(signature);
+                jvmti->Deallocate(reinterpret_cast<unsigned char *>(signature));
+                if (!isFiller) {
+                    err = callback(loadedClasses[i]);
+                }
+            }
+        }
+        env->DeleteLocalRef(loadedClasses[i]);
+    }
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(loadedClasses));
+    return err;
+}
+
+jvmtiError ClassIndex::synchronize(JNIEnv *env) {
+    jvmtiError err = JVMTI_ERROR_NONE;
+    if (!loadedClassesRegistered) {
+        objectClass = reinterpret_cast<jclass>(env->NewGlobalRef(env->FindClass("java/lang/Object")));
+        cloneableClass = reinterpret_cast<jclass>(env->NewGlobalRef(env->FindClass("java/lang/Cloneable")));
+        serializableClass = reinterpret_cast<jclass>(env->NewGlobalRef(env->FindClass("java/io/Serializable")));
+
+        // Events are enabled before the loaded classes are listed, so no class is missed in between
+        err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, nullptr);
+        if (!isOk(err)) return err;
+
+        err = registerLoadedClasses(env);
+        if (!isOk(err)) return err;
+        loadedClassesRegistered = true;
+    }
+
+    std::vector<jweak> prepared;
+    {
+        std::lock_guard<std::mutex> lock(preparedClassesMutex);
+        prepared.swap(preparedClasses);
+    }
+
+    for (jweak preparedClass : prepared) {
+        auto klass = reinterpret_cast<jclass>(env->NewLocalRef(preparedClass));
+        env->DeleteWeakGlobalRef(preparedClass);
+        if (klass == nullptr) {
+            continue;
+        }
+
+        jint id;
+        jvmtiError registrationError = registerClass(env, klass, id);
+        env->DeleteLocalRef(klass);
+        if (!isOk(registrationError)) {
+            err = registrationError;
+        }
+    }
+
+    return err;
+}
+
+jvmtiError ClassIndex::registerLoadedClasses(JNIEnv *env) {
+    jint count;
+    jclass *loadedClasses;
+    jvmtiError err = jvmti->GetLoadedClasses(&count, &loadedClasses);
+    if (!isOk(err)) return err;
+
+    for (jint i = 0; i < count; i++) {
+        jint id;
+        if (isOk(err)) {
+            err = registerClass(env, loadedClasses[i], id);
+        }
+        env->DeleteLocalRef(loadedClasses[i]);
+    }
+
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(loadedClasses));
+    return err;
+}
+
+jvmtiError ClassIndex::registerClass(JNIEnv *env, jclass klass, jint &id) {
+    jlong tag;
+    jvmtiError err = jvmti->GetTag(klass, &tag);
+    if (!isOk(err)) return err;
+    id = static_cast<jint>(tag);
+    if (id != 0) {
+        return err;
+    }
+
+    // Interfaces of a class are not known before it is prepared, it will be registered on ClassPrepare
+    jint status;
+    err = jvmti->GetClassStatus(klass, &status);
+    if (!isOk(err)) return err;
+    bool isArray = (status & JVMTI_CLASS_STATUS_ARRAY) != 0;
+    if (!isArray && (status & JVMTI_CLASS_STATUS_PREPARED) == 0) {
+        return err;
+    }
+
+    char *signature;
+    err = jvmti->GetClassSignature(klass, &signature, nullptr);
+    if (!isOk(err)) return err;
+    bool isFiller = isFillerClass(signature);
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(signature));
+
+    ClassInfo info{env->NewWeakGlobalRef(klass), {}, {}, isArray, isFiller};
+    if (freeIds.empty()) {
+        id = static_cast<jint>(classes.size());
+        classes.push_back(info);
+    } else {
+        id = freeIds.back();
+        freeIds.pop_back();
+        classes[id] = info;
+    }
+    err = jvmti->SetTag(klass, id);
+    if (!isOk(err)) return err;
+
+    jclass superclass = env->GetSuperclass(klass);
+    if (superclass != nullptr) {
+        err = registerSupertype(env, superclass, id);
+        env->DeleteLocalRef(superclass);
+        if (!isOk(err)) return err;
+    } else if (!env->IsSameObject(klass, objectClass)) {
+        // Interfaces have no superclass, but they are still assignable to Object
+        err = registerSupertype(env, objectClass, id);
+        if (!isOk(err)) return err;
+    }
+
+    if (isArray) {
+        // Arrays implement these interfaces implicitly, GetImplementedInterfaces returns nothing for them
+        err = registerSupertype(env, cloneableClass, id);
+        if (isOk(err)) {
+            err = registerSupertype(env, serializableClass, id);
+        }
+        return err;
+    }
+
+    jint interfacesCount;
+    jclass *interfaces;
+    err = jvmti->GetImplementedInterfaces(klass, &interfacesCount, &interfaces);
+    if (!isOk(err)) return err;
+    for (jint i = 0; i < interfacesCount; i++) {
+        if (isOk(err)) {
+            err = registerSupertype(env, interfaces[i], id);
+        }
+        env->DeleteLocalRef(interfaces[i]);
+    }
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(interfaces));
+
+    return err;
+}
+
+jvmtiError ClassIndex::registerSupertype(JNIEnv *env, jclass supertype, jint subtypeId) {
+    jint supertypeId;
+    jvmtiError err = registerClass(env, supertype, supertypeId);
+    if (isOk(err) && supertypeId != 0) {
+        classes[supertypeId].subtypes.push_back(subtypeId);
+        classes[subtypeId].supertypes.push_back(supertypeId);
+    }
+    return err;
+}
+
+// Subtypes of an unloaded class are unloaded too, so the class is unlinked from both sides before its id is reused
+void ClassIndex::unregisterClass(JNIEnv *env, jint id) {
+    ClassInfo &info = classes[id];
+    for (jint supertype : info.supertypes) {
+        std::vector<jint> &subtypes = classes[supertype].subtypes;
+        subtypes.erase(std::remove(subtypes.begin(), subtypes.end(), id), subtypes.end());
+    }
+    for (jint subtype : info.subtypes) {
+        std::vector<jint> &supertypes = classes[subtype].supertypes;
+        supertypes.erase(std::remove(supertypes.begin(), supertypes.end(), id), supertypes.end());
+    }
+
+    env->DeleteWeakGlobalRef(info.klass);
+    info = ClassInfo{nullptr, {}, {}, false, false};
+    freeIds.push_back(id);
+}
+
+bool ClassIndex::canHaveArraySubtypes(JNIEnv *env, jclass klass, jint id) {
+    return classes[id].isArray ||
+           env->IsSameObject(klass, cloneableClass) ||
+           env->IsSameObject(klass, serializableClass);
+}
@@ -0,0 +1,69 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_CLASS_INDEX_H
+#define MEMORY_AGENT_CLASS_INDEX_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "jni.h"
+#include "jvmti.h"
+
+/*
+ * Native index of the class hierarchy. Classes are tagged with their ids in a dedicated
+ * jvmtiEnv, so these tags never clash with the tags set by the actions. The index is built
+ * from loaded classes on the first query and then updated with ClassPrepare events.
+ * Array classes don't produce ClassPrepare events, so they are looked up among loaded
+ * classes only for queries that can match them. Every loaded class is a subtype of Object,
+ * so queries for it list loaded classes directly and drop unloaded classes from the index.
+ * Ids of unloaded classes are reused. One thread at a time uses the index without holding
+ * a lock, concurrent queries scan loaded classes with JNI IsAssignableFrom instead.
+ */
+class ClassIndex {
+public:
+    jvmtiError init(JavaVM *vm);
+
+    // Calls the callback for the class and every loaded class assignable to it
+    jvmtiError forEachSubtype(JNIEnv *env, jclass klass, const std::function<jvmtiError(jclass)> &callback);
+
+    void onClassPrepare(JNIEnv *env, jclass klass);
+
+private:
+    struct ClassInfo {
+        jweak klass;
+        std::vector<jint> subtypes;
+        std::vector<jint> supertypes;
+        bool isArray;
+        bool isFiller;
+    };
+
+    jvmtiError synchronize(JNIEnv *env);
+    jvmtiError collectSubtypes(JNIEnv *env, jclass klass, std::vector<jclass> &subtypes);
+    jvmtiError collectLoadedClasses(JNIEnv *env, std::vector<jclass> &subtypes);
+    jvmtiError forEachAssignableLoadedClass(JNIEnv *env, jclass klass, const std::function<jvmtiError(jclass)> &callback);
+    jvmtiError registerLoadedClasses(JNIEnv *env);
+    jvmtiError registerClass(JNIEnv *env, jclass klass, jint &id);
+    jvmtiError registerSupertype(JNIEnv *env, jclass supertype, jint subtypeId);
+    void unregisterClass(JNIEnv *env, jint id);
+    bool canHaveArraySubtypes(JNIEnv *env, jclass klass, jint id);
+
+private:
+    jvmtiEnv *jvmti = nullptr;
+    // Slots of unloaded classes have no class reference until their ids are reused
+    std::vector<ClassInfo> classes;
+    std::vector<jint> freeIds;
+    std::vector<jweak> preparedClasses;
+    std::mutex preparedClassesMutex;
+    std::atomic<bool> isBusy{false};
+    bool loadedClassesRegistered = false;
+    jclass objectClass = nullptr;
+    jclass cloneableClass = nullptr;
+    jclass serializableClass = nullptr;
+};
+
+extern ClassIndex classIndex;
+
+extern "C" JNIEXPORT void JNICALL ClassPrepare(jvmtiEnv *jvmti, JNIEnv *env, jthread thread, jclass klass);
+
+#endif //MEMORY_AGENT_CLASS_INDEX_H
@@ -0,0 +1,31 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include "heap_graph.h"
+
+HeapGraph::HeapGraph() : graph(1), sizes(1) {
+
+}
+
+jlong HeapGraph::addVertex(jlong size) {
+    graph.emplace_back();
+    sizes.push_back(size);
+    return static_cast<jlong>(graph.size()) - 1;
+}
+
+void HeapGraph::addEdge(jlong from, jlong to) {
+    graph[from].push_back(to);
+}
+
+jint JNICALL HeapGraph::captureReference(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                                         jlong referrerClassTag, jlong size, jlong *tagPtr,
+                                         jlong *referrerTagPtr, jint length, void *userData) {
+    auto *heapGraph = reinterpret_cast<HeapGraph *>(userData);
+    jlong referrer = referrerTagPtr == nullptr ? heapGraph->getRootVertex(refKind, refInfo) : *referrerTagPtr;
+    if (*tagPtr == 0) {
+        *tagPtr = heapGraph->addVertex(size);
+    }
+    heapGraph->addReference(referrer, *tagPtr, refKind, refInfo);
+
+    // FollowReferences expands every object only once, so there is no need to track visited objects here
+    return JVMTI_VISIT_OBJECTS;
+}
@@ -0,0 +1,41 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_HEAP_GRAPH_H
+#define MEMORY_AGENT_HEAP_GRAPH_H
+
+#include <vector>
+#include <jvmti.h>
+
+/*
+ * Object graph of the whole heap captured with a single FollowReferences call.
+ * Every reached object is tagged with its vertex number, vertex 0 is the virtual root.
+ * Heap roots are attached to the vertex returned by getRootVertex, so subclasses
+ * can put virtual vertices between the root and the objects. References to skip,
+ * e.g. JNI ones, are filtered out by the reference filter of the traversing action.
+ */
+class HeapGraph {
+public:
+    HeapGraph();
+    virtual ~HeapGraph() = default;
+
+    jlong addVertex(jlong size);
+
+    void addEdge(jlong from, jlong to);
+
+    static jint JNICALL captureReference(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                                         jlong referrerClassTag, jlong size, jlong *tagPtr,
+                                         jlong *referrerTagPtr, jint length, void *userData);
+
+protected:
+    virtual jlong getRootVertex(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo) { return 0; }
+
+    virtual void addReference(jlong from, jlong to, jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo) {
+        addEdge(from, to);
+    }
+
+public:
+    std::vector<std::vector<jlong>> graph;
+    std::vector<jlong> sizes;
+};
+
+#endif //MEMORY_AGENT_HEAP_GRAPH_H
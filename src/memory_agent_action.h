@@ -11,6 +11,7 @@
 #include "utils.h"
 #include "cancellation_checker.h"
 #include "progress_manager.h"
+#include "reference_filter.h"
 
 #define MEMORY_AGENT_INTERRUPTED_ERROR static_cast<jvmtiError>(999)
 
@@ -18,14 +19,16 @@ template<typename RESULT_TYPE, typename... ARGS_TYPES>
 class MemoryAgentAction : public CancellationChecker {
 private:
     struct CallbackWrapperData {
-        CallbackWrapperData(void *callback, void *userData, const CancellationChecker *cancellationChecker) :
-                callback(callback), userData(userData), cancellationChecker(cancellationChecker) {
+        CallbackWrapperData(void *callback, void *userData, const CancellationChecker *cancellationChecker,
+                            const ReferenceFilter *referenceFilter = nullptr) :
+                callback(callback), userData(userData), cancellationChecker(cancellationChecker), referenceFilter(referenceFilter) {
 
         }
 
         void *callback;
         void *userData;
         const CancellationChecker *cancellationChecker;
+        const ReferenceFilter *referenceFilter;
     };
 
     enum class ErrorCode {
@@ -61,6 +64,8 @@ private:
 
 protected:
     ProgressManager progressManager;
+    // Applied to all FollowReferences calls of the action, callbacks never see ignored references
+    ReferenceFilter referenceFilter;
     JNIEnv *env;
     jvmtiEnv *jvmti;
 };
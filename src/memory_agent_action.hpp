@@ -19,6 +19,15 @@ MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...>::MemoryAgentAction(JNIEnv *env, jv
     cancellationFileName = jstringTostring(env, reinterpret_cast<jstring>(cancellationFileNameField));
     std::string progressFileName = jstringTostring(env, reinterpret_cast<jstring>(progressFileNameField));
     progressManager.setProgressFileName(progressFileName);
+
+    // Older proxies have no reference filter fields
+    jfieldID ignoredReferenceKindsId = env->GetFieldID(thisClass, "ignoredReferenceKinds", "I");
+    jfieldID ignoredThreadId = ignoredReferenceKindsId ? env->GetFieldID(thisClass, "ignoredThreadId", "J") : nullptr;
+    if (ignoredThreadId != nullptr) {
+        referenceFilter = ReferenceFilter(env->GetIntField(object, ignoredReferenceKindsId), env->GetLongField(object, ignoredThreadId));
+    } else {
+        env->ExceptionClear();
+    }
     if (timeout < 0) {
         finishTime = std::chrono::steady_clock::time_point::max();
     } else {
@@ -28,7 +37,7 @@ MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...>::MemoryAgentAction(JNIEnv *env, jv
 
 template<typename RESULT_TYPE, typename... ARGS_TYPES>
 jobjectArray MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...>::run(ARGS_TYPES... args) {
-    ThreadSuspender suspender(jvmti);
+    ThreadSuspender suspender(env, jvmti);
     progressManager.updateProgress(0, "Operation starting...");
     RESULT_TYPE result = executeOperation(args...);
     progressManager.updateProgress(99, "Cleaning heap...");
@@ -54,6 +63,12 @@ jint JNICALL MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...>::followReferencesCall
     if (wrapperData->cancellationChecker->shouldStopExecutionSyscallSafe()) {
         return JVMTI_VISIT_ABORT;
     }
+    if (wrapperData->referenceFilter->isIgnored(refKind, refInfo)) {
+        return 0;
+    }
+    if (wrapperData->referenceFilter->isHidden(refKind)) {
+        return JVMTI_VISIT_OBJECTS;
+    }
     return reinterpret_cast<jvmtiHeapReferenceCallback>(wrapperData->callback)(refKind, refInfo, classTag, referrerClassTag, size, tagPtr, referrerTagPtr, length, wrapperData->userData);
 }
 
@@ -80,7 +95,7 @@ jvmtiError MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...>::FollowReferences(jint
     std::memset(&cb, 0, sizeof(jvmtiHeapCallbacks));
     cb.heap_reference_callback = followReferencesCallbackWrapper;
 
-    CallbackWrapperData wrapperData(reinterpret_cast<void *>(callback), userData, dynamic_cast<const CancellationChecker *>(this));
+    CallbackWrapperData wrapperData(reinterpret_cast<void *>(callback), userData, dynamic_cast<const CancellationChecker *>(this), &referenceFilter);
     return jvmti->FollowReferences(heapFilter, klass, initialObject, &cb, &wrapperData);
 }
 
@@ -0,0 +1,156 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <cstring>
+#include <vector>
+#include "object_watch_list.h"
+#include "utils.h"
+
+// GC events may still arrive while the VM exits, so it is never destroyed
+ObjectWatchList &objectWatchList = *new ObjectWatchList();
+
+extern "C" JNIEXPORT void JNICALL WatchedObjectFree(jvmtiEnv *jvmti, jlong tag) {
+    objectWatchList.onObjectFree(tag);
+}
+
+extern "C" JNIEXPORT void JNICALL WatchedGarbageCollectionFinish(jvmtiEnv *jvmti) {
+    objectWatchList.onGarbageCollectionFinish();
+}
+
+jvmtiError ObjectWatchList::init(JavaVM *vm) {
+    if (jvmti != nullptr) {
+        return JVMTI_ERROR_NONE;
+    }
+
+    jvmtiEnv *watchEnv = nullptr;
+    jint result = vm->GetEnv(reinterpret_cast<void **>(&watchEnv), JVMTI_VERSION_1_0);
+    if (result != JNI_OK || watchEnv == nullptr) {
+        return JVMTI_ERROR_NOT_AVAILABLE;
+    }
+
+    jvmtiCapabilities capabilities;
+    std::memset(&capabilities, 0, sizeof(jvmtiCapabilities));
+    capabilities.can_tag_objects = 1;
+    capabilities.can_generate_object_free_events = 1;
+    capabilities.can_generate_garbage_collection_events = 1;
+    jvmtiError err = watchEnv->AddCapabilities(&capabilities);
+    if (!isOk(err)) return err;
+
+    jvmtiEventCallbacks callbacks;
+    std::memset(&callbacks, 0, sizeof(jvmtiEventCallbacks));
+    callbacks.ObjectFree = WatchedObjectFree;
+    callbacks.GarbageCollectionFinish = WatchedGarbageCollectionFinish;
+    err = watchEnv->SetEventCallbacks(&callbacks, sizeof(jvmtiEventCallbacks));
+    if (!isOk(err)) return err;
+
+    err = watchEnv->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_OBJECT_FREE, nullptr);
+    if (!isOk(err)) return err;
+    err = watchEnv->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH, nullptr);
+    if (!isOk(err)) return err;
+
+    jvmti = watchEnv;
+    return JVMTI_ERROR_NONE;
+}
+
+jvmtiError ObjectWatchList::watch(JNIEnv *env, jobjectArray objects) {
+    if (jvmti == nullptr) {
+        return JVMTI_ERROR_NOT_AVAILABLE;
+    }
+
+    // An action may suspend this thread inside any JNI or JVMTI call, so none of them are made under the lock
+    for (jsize i = 0; i < env->GetArrayLength(objects); i++) {
+        jobject object = env->GetObjectArrayElement(objects, i);
+        jlong tag;
+        jvmtiError err = jvmti->GetTag(object, &tag);
+        if (!isOk(err)) return err;
+
+        if (tag == 0) {
+            tag = ++lastTag;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                watchedObjects[tag] = collectionsCount.load();
+            }
+            err = jvmti->SetTag(object, tag);
+            if (!isOk(err)) {
+                onObjectFree(tag);
+                return err;
+            }
+        }
+        env->DeleteLocalRef(object);
+    }
+
+    return JVMTI_ERROR_NONE;
+}
+
+jobjectArray ObjectWatchList::getSurvivors(JNIEnv *env, jint minCollections) {
+    std::vector<jlong> tags;
+    jlong collections = collectionsCount.load();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &entry : watchedObjects) {
+            if (collections - entry.second >= minCollections) {
+                tags.push_back(entry.first);
+            }
+        }
+    }
+
+    // Only objects that are still alive are returned by tags
+    std::vector<jobject> survivors;
+    std::vector<jlong> survivedCollections;
+    if (jvmti != nullptr && !tags.empty()) {
+        jint count;
+        jobject *objects;
+        jlong *objectsTags;
+        jvmtiError err = jvmti->GetObjectsWithTags(static_cast<jint>(tags.size()), tags.data(), &count, &objects, &objectsTags);
+        if (isOk(err)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (jint i = 0; i < count; i++) {
+                auto it = watchedObjects.find(objectsTags[i]);
+                survivors.push_back(objects[i]);
+                survivedCollections.push_back(it == watchedObjects.end() ? 0 : collections - it->second);
+            }
+        }
+        if (isOk(err)) {
+            jvmti->Deallocate(reinterpret_cast<unsigned char *>(objects));
+            jvmti->Deallocate(reinterpret_cast<unsigned char *>(objectsTags));
+        }
+    }
+
+    jobjectArray result = env->NewObjectArray(2, env->FindClass("java/lang/Object"), nullptr);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, survivors));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, survivedCollections));
+    return result;
+}
+
+void ObjectWatchList::clear() {
+    std::vector<jlong> tags;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &entry : watchedObjects) {
+            tags.push_back(entry.first);
+        }
+        watchedObjects.clear();
+    }
+
+    if (jvmti == nullptr || tags.empty()) {
+        return;
+    }
+
+    jint count;
+    jobject *objects;
+    jvmtiError err = jvmti->GetObjectsWithTags(static_cast<jint>(tags.size()), tags.data(), &count, &objects, nullptr);
+    if (!isOk(err)) return;
+
+    for (jint i = 0; i < count; i++) {
+        jvmti->SetTag(objects[i], 0);
+    }
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(objects));
+}
+
+void ObjectWatchList::onObjectFree(jlong tag) {
+    std::lock_guard<std::mutex> lock(mutex);
+    watchedObjects.erase(tag);
+}
+
+void ObjectWatchList::onGarbageCollectionFinish() {
+    collectionsCount.fetch_add(1);
+}
@@ -0,0 +1,48 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_OBJECT_WATCH_LIST_H
+#define MEMORY_AGENT_OBJECT_WATCH_LIST_H
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include "jni.h"
+#include "jvmti.h"
+
+/*
+ * Objects expected to be garbage collected soon. They are tagged in a dedicated jvmtiEnv,
+ * where ObjectFree events remove them from the list and GarbageCollectionFinish events count
+ * garbage collections. So objects that survived a number of collections are known without
+ * any heap traversal, and only they need the expensive paths to GC roots analysis.
+ */
+class ObjectWatchList {
+public:
+    jvmtiError init(JavaVM *vm);
+
+    jvmtiError watch(JNIEnv *env, jobjectArray objects);
+
+    // Returns watched objects that survived at least the given number of collections and these numbers
+    jobjectArray getSurvivors(JNIEnv *env, jint minCollections);
+
+    void clear();
+
+    void onObjectFree(jlong tag);
+
+    void onGarbageCollectionFinish();
+
+private:
+    jvmtiEnv *jvmti = nullptr;
+    std::atomic<jlong> collectionsCount{0};
+    std::atomic<jlong> lastTag{0};
+    std::mutex mutex;
+    // Number of collections at the moment of registration by tags
+    std::unordered_map<jlong, jlong> watchedObjects;
+};
+
+extern ObjectWatchList &objectWatchList;
+
+extern "C" JNIEXPORT void JNICALL WatchedObjectFree(jvmtiEnv *jvmti, jlong tag);
+
+extern "C" JNIEXPORT void JNICALL WatchedGarbageCollectionFinish(jvmtiEnv *jvmti);
+
+#endif //MEMORY_AGENT_OBJECT_WATCH_LIST_H
@@ -1,20 +1,87 @@
 // Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
 
+#include <unordered_map>
+#include <unordered_set>
 #include "../roots/paths_to_closest_gc_roots.h"
 #include "objects_of_class_in_heap.h"
 
-#define CLASS_TAG 1
-#define REFERENCE_CLASS_TAG 2
-#define WEAK_SOFT_REACHABLE_TAG 3
-#define STRONG_REACHABLE_TAG 4
-#define OBJECT_OF_CLASS_TAG 5
+#define REFERENCE_CLASS_TAG (-1)
 
-jint JNICALL findReachableObjectsOfClass(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
-                                        jlong referrerClassTag, jlong size, jlong *tagPtr,
-                                        jlong *referrerTagPtr, jint length, void *userData) {
-    if (*tagPtr == REFERENCE_CLASS_TAG || *tagPtr == CLASS_TAG) {
+static size_t tagToSlot(jlong tag) {
+    return static_cast<size_t>(-tag - 1);
+}
+
+ReachableObjectsInfo::ReachableObjectsInfo(jsize queriesCount, ReachabilityMode mode, size_t samplesLimit) :
+    slots{ClassSlot{true, {}}}, mode(mode), counts(queriesCount, 0), sizes(queriesCount, 0), samples(queriesCount),
+    notFoundCount(queriesCount), samplesLimit(samplesLimit), firstSampleTag(0), nextSampleTag(0) {
+
+}
+
+jint ReachableObjectsInfo::onObjectFound(size_t slot, jlong size, jlong *tagPtr) {
+    for (jsize query : slots[slot].queries) {
+        if (counts[query]++ == 0) {
+            notFoundCount--;
+        }
+        sizes[query] += size;
+        addSample(query, tagPtr);
+    }
+
+    if (mode == ReachabilityMode::FIRST && notFoundCount == 0) {
+        return JVMTI_VISIT_ABORT;
+    }
+    return JVMTI_VISIT_OBJECTS;
+}
+
+void ReachableObjectsInfo::addSample(jsize query, jlong *tagPtr) {
+    if (samplesLimit == 0) return;
+
+    std::vector<jlong> &querySamples = samples[query];
+    size_t index = querySamples.size();
+    if (index >= samplesLimit) {
+        index = std::uniform_int_distribution<jlong>(0, counts[query] - 1)(random);
+        if (index >= samplesLimit) return;
+    }
+
+    if (firstSampleTag == 0) {
+        firstSampleTag = nextSampleTag = OBJECT_OF_CLASS_BASE_TAG + static_cast<jlong>(slots.size());
+    }
+    if (*tagPtr < firstSampleTag) {
+        *tagPtr = nextSampleTag++;
+    }
+
+    if (index == querySamples.size()) {
+        querySamples.push_back(*tagPtr);
+    } else {
+        querySamples[index] = *tagPtr;
+    }
+}
+
+std::vector<jlong> ReachableObjectsInfo::getObjectTags() const {
+    std::vector<jlong> tags;
+    for (size_t i = 1; i < slots.size(); i++) {
+        tags.push_back(OBJECT_OF_CLASS_BASE_TAG + static_cast<jlong>(i));
+    }
+    return tags;
+}
+
+std::vector<jlong> ReachableObjectsInfo::getSampleTags() const {
+    std::unordered_set<jlong> tags;
+    for (const std::vector<jlong> &querySamples : samples) {
+        tags.insert(querySamples.begin(), querySamples.end());
+    }
+    return std::vector<jlong>(tags.begin(), tags.end());
+}
+
+jint JNICALL findReachableObjectsOfClasses(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                                           jlong referrerClassTag, jlong size, jlong *tagPtr,
+                                           jlong *referrerTagPtr, jint length, void *userData) {
+    if (*tagPtr < 0) {
         return JVMTI_VISIT_OBJECTS;
-    } else if (classTag == REFERENCE_CLASS_TAG) {
+    }
+
+    auto *info = reinterpret_cast<ReachableObjectsInfo *>(userData);
+    bool isReference = classTag < 0 && info->slots[tagToSlot(classTag)].isReference;
+    if (isReference) {
         *tagPtr = WEAK_SOFT_REACHABLE_TAG; // tag soft/weak/phantom reference
     } else if (*tagPtr == 0) {
         if (referrerTagPtr != nullptr && *referrerTagPtr == WEAK_SOFT_REACHABLE_TAG) {
@@ -28,64 +95,141 @@ jint JNICALL findReachableObjectsOfClass(jvmtiHeapReferenceKind refKind, const j
         }
     }
 
-    if (classTag == CLASS_TAG && *tagPtr == STRONG_REACHABLE_TAG) {
-        *tagPtr = OBJECT_OF_CLASS_TAG;
-        if (*reinterpret_cast<bool *>(userData)) {
-            return JVMTI_VISIT_ABORT;
-        }
+    if (classTag < 0 && !isReference && *tagPtr == STRONG_REACHABLE_TAG) {
+        size_t slot = tagToSlot(classTag);
+        *tagPtr = OBJECT_OF_CLASS_BASE_TAG + static_cast<jlong>(slot);
+        return info->onObjectFound(slot, size, tagPtr);
     }
     return JVMTI_VISIT_OBJECTS;
 }
 
-
-static jvmtiError getReachableObjectsOfClass(JNIEnv *env, jvmtiEnv *jvmti, jobject startObject, jobject classObject, std::vector<jobject> &result, bool findFirst) {
+jvmtiError tagQueriedClasses(JNIEnv *env, jvmtiEnv *jvmti, const std::vector<jobject> &classes, ReachableObjectsInfo &info) {
     setTagsForReferences(env, jvmti, REFERENCE_CLASS_TAG);
 
-    jvmtiError err = tagClassAndItsInheritors(env, jvmti, classObject, [](jlong oldTag) -> jlong { return CLASS_TAG; });
-    if (err != JVMTI_ERROR_NONE) return err;
-
-    jvmtiHeapCallbacks cb;
-    std::memset(&cb, 0, sizeof(jvmtiHeapCallbacks));
-    cb.heap_reference_callback = findReachableObjectsOfClass;
-    err = jvmti->FollowReferences(0, nullptr, startObject, &cb, &findFirst);
-    if (err != JVMTI_ERROR_NONE) return err;
+    for (jsize i = 0; i < classes.size(); i++) {
+        jvmtiError err = tagClassAndItsInheritors(env, jvmti, classes[i], [i, &info](jlong oldTag) -> jlong {
+            if (oldTag < 0 && !info.slots[tagToSlot(oldTag)].isReference) {
+                info.slots[tagToSlot(oldTag)].queries.push_back(i);
+                return 0;
+            }
+
+            // a queried class is never treated as a reference class
+            info.slots.push_back(ReachableObjectsInfo::ClassSlot{false, {i}});
+            return -static_cast<jlong>(info.slots.size());
+        });
+        if (err != JVMTI_ERROR_NONE) return err;
+    }
 
-    return getObjectsByTags(jvmti, std::vector<jlong>{OBJECT_OF_CLASS_TAG}, result);
+    return JVMTI_ERROR_NONE;
 }
 
-GetFirstReachableObjectOfClassAction::GetFirstReachableObjectOfClassAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
+GetFirstReachableObjectOfClassAction::GetFirstReachableObjectOfClassAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : ReachableObjectsOfClassesAction(env, jvmti, object) {
 
 }
 
 jobject GetFirstReachableObjectOfClassAction::executeOperation(jobject startObject, jobject classObject) {
-    std::vector<jobject> result;
-    jvmtiError err = getReachableObjectsOfClass(env, jvmti, startObject, classObject, result, true);
+    ReachableObjectsInfo info(1, ReachabilityMode::FIRST);
+    std::vector<std::vector<jobject>> result;
+    jvmtiError err = findReachableObjects(startObject, std::vector<jobject>{classObject}, info);
+    if (err == JVMTI_ERROR_NONE) {
+        err = collectReachableObjects(info, 1, result);
+    }
     handleError(jvmti, err, "Couldn't check class reachability");
-    return result.empty() ? nullptr : result[0];
-}
-
-jvmtiError GetFirstReachableObjectOfClassAction::cleanHeap() {
-    return removeAllTagsFromHeap(jvmti, nullptr);
+    return result.empty() || result[0].empty() ? nullptr : result[0][0];
 }
 
-GetAllReachableObjectsOfClassAction::GetAllReachableObjectsOfClassAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
+GetAllReachableObjectsOfClassAction::GetAllReachableObjectsOfClassAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : ReachableObjectsOfClassesAction(env, jvmti, object) {
 
 }
 
 jobjectArray GetAllReachableObjectsOfClassAction::executeOperation(jobject startObject, jobject classObject) {
-    std::vector<jobject> reachableObjects;
-    jvmtiError err = getReachableObjectsOfClass(env, jvmti, startObject, classObject, reachableObjects, false);
+    ReachableObjectsInfo info(1, ReachabilityMode::ALL);
+    std::vector<std::vector<jobject>> result;
+    jvmtiError err = findReachableObjects(startObject, std::vector<jobject>{classObject}, info);
+    if (err == JVMTI_ERROR_NONE) {
+        err = collectReachableObjects(info, 1, result);
+    }
     handleError(jvmti, err, "Couldn't get reachable objects of class");
-    jclass langObject = env->FindClass("java/lang/Object");
-    jobjectArray resultArray = env->NewObjectArray(reachableObjects.size(), langObject, nullptr);
+    result.resize(1);
+    return toJavaArray(env, result[0]);
+}
+
+GetReachableObjectsOfClassesAction::GetReachableObjectsOfClassesAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : ReachableObjectsOfClassesAction(env, jvmti, object) {
+
+}
+
+jobject GetReachableObjectsOfClassesAction::executeOperation(jobject startObject, jobjectArray classesArray, jint mode) {
+    if (mode < static_cast<jint>(ReachabilityMode::FIRST) || mode > static_cast<jint>(ReachabilityMode::COUNT)) {
+        logger::error("unknown reachability mode");
+        return nullptr;
+    }
+
+    std::vector<jobject> classes = fromJavaArray(env, classesArray);
+    auto queriesCount = static_cast<jsize>(classes.size());
+    ReachableObjectsInfo info(queriesCount, static_cast<ReachabilityMode>(mode));
+    jvmtiError err = findReachableObjects(startObject, classes, info);
+    handleError(jvmti, err, "Couldn't get reachable objects of classes");
+
+    if (info.mode == ReachabilityMode::COUNT) {
+        return toJavaArray(env, info.counts);
+    }
+
+    std::vector<std::vector<jobject>> reachableObjects;
+    if (err == JVMTI_ERROR_NONE) {
+        err = collectReachableObjects(info, queriesCount, reachableObjects);
+        handleError(jvmti, err, "Couldn't collect reachable objects of classes");
+    }
+    reachableObjects.resize(queriesCount);
 
-    for (jsize i = 0; i < reachableObjects.size(); ++i) {
-        env->SetObjectArrayElement(resultArray, i, reachableObjects[i]);
+    jobjectArray result = env->NewObjectArray(queriesCount, env->FindClass("java/lang/Object"), nullptr);
+    for (jsize i = 0; i < queriesCount; i++) {
+        if (info.mode == ReachabilityMode::FIRST) {
+            env->SetObjectArrayElement(result, i, reachableObjects[i].empty() ? nullptr : reachableObjects[i][0]);
+        } else {
+            env->SetObjectArrayElement(result, i, toJavaArray(env, reachableObjects[i]));
+        }
     }
+    return result;
+}
+
+GetReachableObjectsStatisticsOfClassesAction::GetReachableObjectsStatisticsOfClassesAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : ReachableObjectsOfClassesAction(env, jvmti, object) {
 
-    return resultArray;
 }
 
-jvmtiError GetAllReachableObjectsOfClassAction::cleanHeap() {
-    return removeAllTagsFromHeap(jvmti, nullptr);
+jobjectArray GetReachableObjectsStatisticsOfClassesAction::executeOperation(jobject startObject, jobjectArray classesArray, jint samplesLimit) {
+    std::vector<jobject> classes = fromJavaArray(env, classesArray);
+    auto queriesCount = static_cast<jsize>(classes.size());
+    ReachableObjectsInfo info(queriesCount, ReachabilityMode::COUNT, static_cast<size_t>(std::max(samplesLimit, 0)));
+    jvmtiError err = findReachableObjects(startObject, classes, info);
+    handleError(jvmti, err, "Couldn't get reachable objects statistics of classes");
+
+    std::vector<std::pair<jobject, jlong>> sampledObjects;
+    if (err == JVMTI_ERROR_NONE) {
+        err = getObjectsByTags(jvmti, info.getSampleTags(), sampledObjects);
+        handleError(jvmti, err, "Couldn't collect sampled objects");
+    }
+
+    std::unordered_map<jlong, jobject> tagToObject;
+    for (auto &objectAndTag : sampledObjects) {
+        tagToObject[objectAndTag.second] = objectAndTag.first;
+    }
+
+    jclass langObject = env->FindClass("java/lang/Object");
+    jobjectArray samples = env->NewObjectArray(queriesCount, langObject, nullptr);
+    for (jsize i = 0; i < queriesCount; i++) {
+        std::vector<jobject> querySamples;
+        for (jlong tag : info.samples[i]) {
+            auto it = tagToObject.find(tag);
+            if (it != tagToObject.end()) {
+                querySamples.push_back(it->second);
+            }
+        }
+        env->SetObjectArrayElement(samples, i, toJavaArray(env, querySamples));
+    }
+
+    jobjectArray result = env->NewObjectArray(3, langObject, nullptr);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, info.counts));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, info.sizes));
+    env->SetObjectArrayElement(result, 2, samples);
+    return result;
 }
@@ -3,24 +3,132 @@
 #ifndef MEMORY_AGENT_OBJECTS_OF_CLASS_IN_HEAP_H
 #define MEMORY_AGENT_OBJECTS_OF_CLASS_IN_HEAP_H
 
+#include <random>
+#include <vector>
 #include "../memory_agent_action.h"
 
-class GetFirstReachableObjectOfClassAction : public MemoryAgentAction<jobject, jobject, jobject> {
+#define WEAK_SOFT_REACHABLE_TAG 1
+#define STRONG_REACHABLE_TAG 2
+#define OBJECT_OF_CLASS_BASE_TAG 3
+
+enum class ReachabilityMode {
+    FIRST = 0,
+    ALL = 1,
+    COUNT = 2
+};
+
+/*
+ * Classes of interest are tagged with negative tags: -(slot + 1). Slot 0 is shared by
+ * soft/weak/phantom reference classes, every other slot lists the queries the class belongs to.
+ * A strongly reachable object of a queried class is tagged with OBJECT_OF_CLASS_BASE_TAG + slot,
+ * unless it was picked as a sample: such objects get unique tags above all slot tags.
+ */
+class ReachableObjectsInfo {
+public:
+    struct ClassSlot {
+        bool isReference;
+        std::vector<jsize> queries;
+    };
+
+    ReachableObjectsInfo(jsize queriesCount, ReachabilityMode mode, size_t samplesLimit=0);
+
+    jint onObjectFound(size_t slot, jlong size, jlong *tagPtr);
+
+    std::vector<jlong> getObjectTags() const;
+
+    std::vector<jlong> getSampleTags() const;
+
+    std::vector<ClassSlot> slots;
+    ReachabilityMode mode;
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+    std::vector<std::vector<jlong>> samples;
+
+private:
+    void addSample(jsize query, jlong *tagPtr);
+
+    jsize notFoundCount;
+    size_t samplesLimit;
+    jlong firstSampleTag;
+    jlong nextSampleTag;
+    std::mt19937_64 random;
+};
+
+jint JNICALL findReachableObjectsOfClasses(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                                           jlong referrerClassTag, jlong size, jlong *tagPtr,
+                                           jlong *referrerTagPtr, jint length, void *userData);
+
+jvmtiError tagQueriedClasses(JNIEnv *env, jvmtiEnv *jvmti, const std::vector<jobject> &classes, ReachableObjectsInfo &info);
+
+template<typename RESULT_TYPE, typename... ARGS_TYPES>
+class ReachableObjectsOfClassesAction : public MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...> {
+protected:
+    ReachableObjectsOfClassesAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...>(env, jvmti, object) {
+
+    }
+
+    jvmtiError findReachableObjects(jobject startObject, const std::vector<jobject> &classes, ReachableObjectsInfo &info) {
+        jvmtiError err = tagQueriedClasses(this->env, this->jvmti, classes, info);
+        if (err != JVMTI_ERROR_NONE) return err;
+
+        return this->FollowReferences(0, nullptr, startObject, findReachableObjectsOfClasses, &info, "find reachable objects of classes");
+    }
+
+    // Groups objects found by findReachableObjects by the queries their classes belong to
+    jvmtiError collectReachableObjects(const ReachableObjectsInfo &info, jsize queriesCount, std::vector<std::vector<jobject>> &result) {
+        std::vector<std::pair<jobject, jlong>> objects;
+        jvmtiError err = getObjectsByTags(this->jvmti, info.getObjectTags(), objects);
+        if (err != JVMTI_ERROR_NONE) return err;
+
+        result.resize(queriesCount);
+        for (auto &objectAndTag : objects) {
+            for (jsize query : info.slots[objectAndTag.second - OBJECT_OF_CLASS_BASE_TAG].queries) {
+                result[query].push_back(objectAndTag.first);
+            }
+        }
+        return JVMTI_ERROR_NONE;
+    }
+
+    jvmtiError cleanHeap() override {
+        return removeAllTagsFromHeap(this->jvmti, nullptr);
+    }
+};
+
+class GetFirstReachableObjectOfClassAction : public ReachableObjectsOfClassesAction<jobject, jobject, jobject> {
 public:
     GetFirstReachableObjectOfClassAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
 
 private:
     jobject executeOperation(jobject startObject, jobject classObject) override;
-    jvmtiError cleanHeap() override;
 };
 
-class GetAllReachableObjectsOfClassAction : public MemoryAgentAction<jobjectArray, jobject, jobject> {
+class GetAllReachableObjectsOfClassAction : public ReachableObjectsOfClassesAction<jobjectArray, jobject, jobject> {
 public:
     GetAllReachableObjectsOfClassAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
 
 private:
     jobjectArray executeOperation(jobject startObject, jobject classObject) override;
-    jvmtiError cleanHeap() override;
+};
+
+class GetReachableObjectsOfClassesAction : public ReachableObjectsOfClassesAction<jobject, jobject, jobjectArray, jint> {
+public:
+    GetReachableObjectsOfClassesAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobject executeOperation(jobject startObject, jobjectArray classesArray, jint mode) override;
+};
+
+/*
+ * Counts reachable objects of the given classes and sums up their shallow sizes
+ * without creating a JNI reference per object. At most samplesLimit objects
+ * of every class are returned, chosen uniformly with reservoir sampling.
+ */
+class GetReachableObjectsStatisticsOfClassesAction : public ReachableObjectsOfClassesAction<jobjectArray, jobject, jobjectArray, jint> {
+public:
+    GetReachableObjectsStatisticsOfClassesAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobject startObject, jobjectArray classesArray, jint samplesLimit) override;
 };
 
 #endif //MEMORY_AGENT_OBJECTS_OF_CLASS_IN_HEAP_H
@@ -0,0 +1,145 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <cstdint>
+#include <unordered_map>
+#include "reachability_overlap.h"
+#include "../heap_graph.h"
+
+namespace {
+    jobjectArray getObjectArrayOfSize(JNIEnv *env, size_t size) {
+        return env->NewObjectArray(static_cast<jsize>(size), env->FindClass("java/lang/Object"), nullptr);
+    }
+
+    // Index of the lowest set bit of a non-zero mask, compiler builtins are not portable to MSVC
+    int lowestBitIndex(uint64_t mask) {
+        int index = 0;
+        while ((mask & 1) == 0) {
+            mask >>= 1;
+            index++;
+        }
+        return index;
+    }
+}
+
+ReachabilityOverlapAction::ReachabilityOverlapAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
+    referenceFilter.ignore(ReferenceFilter::CLASS_METADATA_REFERENCES);
+}
+
+jobjectArray ReachabilityOverlapAction::executeOperation(jobjectArray objects) {
+    jsize count = env->GetArrayLength(objects);
+    if (count > MAX_OBJECTS_COUNT) {
+        logger::error("too many objects to calculate reachability overlap");
+        return nullptr;
+    }
+
+    HeapGraph heapGraph;
+    std::vector<jlong> sources;
+    for (jsize i = 0; i < count; i++) {
+        jobject object = env->GetObjectArrayElement(objects, i);
+        jlong tag;
+        jvmtiError err = jvmti->GetTag(object, &tag);
+        if (!isOk(err)) return nullptr;
+
+        if (tag == 0) {
+            jlong size;
+            err = jvmti->GetObjectSize(object, &size);
+            if (!isOk(err)) return nullptr;
+
+            tag = heapGraph.addVertex(size);
+            err = jvmti->SetTag(object, tag);
+            if (!isOk(err)) return nullptr;
+        }
+        sources.push_back(tag);
+    }
+
+    // Starting from the input array captures exactly the objects reachable from its elements
+    progressManager.updateProgress(10, "Capturing objects reachable from the given ones...");
+    logger::resetTimer();
+    jvmtiError err = FollowReferences(0, nullptr, objects, HeapGraph::captureReference, &heapGraph, "capturing objects graph");
+    logger::logPassedTime();
+    if (!isOk(err) || shouldStopExecution()) return nullptr;
+
+    progressManager.updateProgress(60, "Propagating reachability masks...");
+    std::vector<uint64_t> masks = propagateMasks(heapGraph, sources);
+    if (shouldStopExecution()) return nullptr;
+
+    progressManager.updateProgress(80, "Calculating shared sizes...");
+    std::unordered_map<uint64_t, jlong> sizesByMask;
+    for (size_t vertex = 1; vertex < masks.size(); vertex++) {
+        if (masks[vertex] != 0) {
+            sizesByMask[masks[vertex]] += heapGraph.sizes[vertex];
+        }
+    }
+
+    std::vector<jlong> exclusiveSizes(sources.size());
+    std::vector<std::vector<jlong>> sharedSizes(sources.size(), std::vector<jlong>(sources.size()));
+    for (auto &entry : sizesByMask) {
+        uint64_t mask = entry.first;
+        if ((mask & (mask - 1)) == 0) {
+            exclusiveSizes[lowestBitIndex(mask)] += entry.second;
+        }
+        for (uint64_t first = mask; first != 0; first &= first - 1) {
+            int i = lowestBitIndex(first);
+            for (uint64_t second = first; second != 0; second &= second - 1) {
+                int j = lowestBitIndex(second);
+                sharedSizes[i][j] += entry.second;
+                if (i != j) {
+                    sharedSizes[j][i] += entry.second;
+                }
+            }
+        }
+    }
+
+    progressManager.updateProgress(95, "Packing result...");
+    std::vector<jlong> reachableSizes;
+    jobjectArray sharedSizesArray = getObjectArrayOfSize(env, sources.size());
+    for (size_t i = 0; i < sources.size(); i++) {
+        reachableSizes.push_back(sharedSizes[i][i]);
+        env->SetObjectArrayElement(sharedSizesArray, static_cast<jsize>(i), toJavaArray(env, sharedSizes[i]));
+    }
+
+    jobjectArray result = getObjectArrayOfSize(env, 3);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, reachableSizes));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, exclusiveSizes));
+    env->SetObjectArrayElement(result, 2, sharedSizesArray);
+    return result;
+}
+
+std::vector<uint64_t> ReachabilityOverlapAction::propagateMasks(const HeapGraph &heapGraph, const std::vector<jlong> &sources) {
+    const std::vector<std::vector<jlong>> &graph = heapGraph.graph;
+    std::vector<uint64_t> masks(graph.size());
+    std::vector<bool> inWorklist(graph.size());
+    std::vector<jlong> worklist;
+    for (size_t i = 0; i < sources.size(); i++) {
+        masks[sources[i]] |= uint64_t(1) << i;
+        if (!inWorklist[sources[i]]) {
+            inWorklist[sources[i]] = true;
+            worklist.push_back(sources[i]);
+        }
+    }
+
+    // Masks only grow, so every vertex is requeued at most once per source
+    while (!worklist.empty()) {
+        if (shouldStopExecution()) break;
+
+        jlong vertex = worklist.back();
+        worklist.pop_back();
+        inWorklist[vertex] = false;
+        for (jlong neighbour : graph[vertex]) {
+            uint64_t merged = masks[neighbour] | masks[vertex];
+            if (merged != masks[neighbour]) {
+                masks[neighbour] = merged;
+                if (!inWorklist[neighbour]) {
+                    inWorklist[neighbour] = true;
+                    worklist.push_back(neighbour);
+                }
+            }
+        }
+    }
+
+    return masks;
+}
+
+jvmtiError ReachabilityOverlapAction::cleanHeap() {
+    return removeAllTagsFromHeap(jvmti, nullptr);
+}
@@ -0,0 +1,31 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_REACHABILITY_OVERLAP_H
+#define MEMORY_AGENT_REACHABILITY_OVERLAP_H
+
+#include <vector>
+#include "../memory_agent_action.h"
+
+// Forward declaration
+class HeapGraph;
+
+/*
+ * Calculates sizes of objects reachable from each pair of at most 64 given objects.
+ * The part of the heap reachable from any of them is captured once, then a 64-bit mask
+ * of the objects reaching a vertex is propagated through the graph, so all pairs cost
+ * about as much as a single traversal. Class metadata references are not followed.
+ */
+class ReachabilityOverlapAction : public MemoryAgentAction<jobjectArray, jobjectArray> {
+public:
+    static const jsize MAX_OBJECTS_COUNT = 64;
+
+    ReachabilityOverlapAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobjectArray objects) override;
+    jvmtiError cleanHeap() override;
+
+    std::vector<uint64_t> propagateMasks(const HeapGraph &heapGraph, const std::vector<jlong> &sources);
+};
+
+#endif //MEMORY_AGENT_REACHABILITY_OVERLAP_H
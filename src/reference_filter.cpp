@@ -0,0 +1,50 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include "reference_filter.h"
+
+const jint ReferenceFilter::JNI_REFERENCES = kindBit(JVMTI_HEAP_REFERENCE_JNI_LOCAL) |
+                                             kindBit(JVMTI_HEAP_REFERENCE_JNI_GLOBAL);
+
+const jint ReferenceFilter::CLASS_METADATA_REFERENCES = kindBit(JVMTI_HEAP_REFERENCE_CLASS) |
+                                                        kindBit(JVMTI_HEAP_REFERENCE_CLASS_LOADER) |
+                                                        kindBit(JVMTI_HEAP_REFERENCE_SIGNERS) |
+                                                        kindBit(JVMTI_HEAP_REFERENCE_PROTECTION_DOMAIN) |
+                                                        kindBit(JVMTI_HEAP_REFERENCE_INTERFACE) |
+                                                        kindBit(JVMTI_HEAP_REFERENCE_SUPERCLASS) |
+                                                        kindBit(JVMTI_HEAP_REFERENCE_CONSTANT_POOL);
+
+ReferenceFilter::ReferenceFilter(jint ignoredKinds, jlong ignoredThreadId) :
+    ignoredKinds(ignoredKinds), ignoredThreadId(ignoredThreadId) {
+
+}
+
+jint ReferenceFilter::kindBit(jvmtiHeapReferenceKind kind) {
+    return 1 << kind;
+}
+
+void ReferenceFilter::ignore(jint kinds) {
+    ignoredKinds |= kinds;
+}
+
+void ReferenceFilter::hide(jint kinds) {
+    hiddenKinds |= kinds;
+}
+
+bool ReferenceFilter::isIgnored(jvmtiHeapReferenceKind kind, const jvmtiHeapReferenceInfo *info) const {
+    if (ignoredKinds & kindBit(kind)) {
+        return true;
+    }
+
+    if (ignoredThreadId >= 0) {
+        if (kind == JVMTI_HEAP_REFERENCE_STACK_LOCAL) {
+            return info->stack_local.thread_id == ignoredThreadId;
+        } else if (kind == JVMTI_HEAP_REFERENCE_JNI_LOCAL) {
+            return info->jni_local.thread_id == ignoredThreadId;
+        }
+    }
+    return false;
+}
+
+bool ReferenceFilter::isHidden(jvmtiHeapReferenceKind kind) const {
+    return (hiddenKinds & kindBit(kind)) != 0;
+}
@@ -0,0 +1,39 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_REFERENCE_FILTER_H
+#define MEMORY_AGENT_REFERENCE_FILTER_H
+
+#include "jvmti.h"
+
+/*
+ * This class decides which references are skipped by heap traversals.
+ * Kinds of ignored references are kept as a bit mask with a bit per jvmtiHeapReferenceKind,
+ * stack references of one thread can be ignored as well. Ignored references are not reported
+ * to traversal callbacks and their referees are not visited through them. Hidden references
+ * are not reported either, but their referees are still visited.
+ */
+class ReferenceFilter {
+public:
+    static const jint JNI_REFERENCES;
+    static const jint CLASS_METADATA_REFERENCES;
+
+    ReferenceFilter() = default;
+    ReferenceFilter(jint ignoredKinds, jlong ignoredThreadId);
+
+    static jint kindBit(jvmtiHeapReferenceKind kind);
+
+    void ignore(jint kinds);
+
+    void hide(jint kinds);
+
+    bool isIgnored(jvmtiHeapReferenceKind kind, const jvmtiHeapReferenceInfo *info) const;
+
+    bool isHidden(jvmtiHeapReferenceKind kind) const;
+
+private:
+    jint ignoredKinds = 0;
+    jint hiddenKinds = 0;
+    jlong ignoredThreadId = -1;
+};
+
+#endif //MEMORY_AGENT_REFERENCE_FILTER_H
@@ -15,8 +15,8 @@ StackInfo::StackInfo(jlong tag, jvmtiHeapReferenceKind kind, jlong threadId, jin
 
 }
 
-static jlongArray buildStackInfo(JNIEnv *env, jlong threadId, jint depth, jint slot) {
-    std::vector<jlong> vector = {threadId, depth, slot};
+static jlongArray buildStackInfo(JNIEnv *env, jlong threadId, jint depth, jint slot, jint methodIndex) {
+    std::vector<jlong> vector = {threadId, depth, slot, methodIndex};
     return toJavaArray(env, vector);
 }
 
@@ -38,10 +38,44 @@ static jobjectArray buildMethodInfo(JNIEnv *env, jvmtiEnv *jvmti, jmethodID id)
     return result;
 }
 
-jobject StackInfo::getReferenceInfo(JNIEnv *env, jvmtiEnv *jvmti) {
+MethodInfoCache::MethodInfoCache(JNIEnv *env, jvmtiEnv *jvmti) : env(env), jvmti(jvmti) {
+
+}
+
+jint MethodInfoCache::getIndex(jmethodID id) {
+    if (id == nullptr) {
+        return -1;
+    }
+
+    auto it = methodToIndex.find(id);
+    if (it != methodToIndex.end()) {
+        return it->second;
+    }
+
+    auto index = static_cast<jint>(methodInfos.size());
+    methodInfos.push_back(buildMethodInfo(env, jvmti, id));
+    methodToIndex[id] = index;
+    return index;
+}
+
+jobject MethodInfoCache::getMethodInfo(jint index) const {
+    return index < 0 ? nullptr : methodInfos[index];
+}
+
+jobjectArray MethodInfoCache::toJavaArray() const {
+    auto size = static_cast<jsize>(methodInfos.size());
+    jobjectArray result = env->NewObjectArray(size, env->FindClass("java/lang/Object"), nullptr);
+    for (jsize i = 0; i < size; i++) {
+        env->SetObjectArrayElement(result, i, methodInfos[i]);
+    }
+    return result;
+}
+
+jobject StackInfo::getReferenceInfo(JNIEnv *env, MethodInfoCache &methodInfos) {
+    jint methodIndex = methodInfos.getIndex(methodId);
     return wrapWithArray(env,
-            buildStackInfo(env, threadId, depth, slot),
-            buildMethodInfo(env, jvmti, methodId)
+            buildStackInfo(env, threadId, depth, slot, methodIndex),
+            methodInfos.getMethodInfo(methodIndex)
     );
 }
 
@@ -3,15 +3,38 @@
 #ifndef MEMORY_AGENT_INFOS_H
 #define MEMORY_AGENT_INFOS_H
 
+#include <unordered_map>
+#include <vector>
 #include "jni.h"
 #include "jvmti.h"
 #include "../utils.h"
 
+/*
+ * Interns method infos while a result is being built, so every distinct method
+ * is resolved and converted to Java strings only once. Links refer to methods by index.
+ */
+class MethodInfoCache {
+public:
+    MethodInfoCache(JNIEnv *env, jvmtiEnv *jvmti);
+
+    jint getIndex(jmethodID id);
+
+    jobject getMethodInfo(jint index) const;
+
+    jobjectArray toJavaArray() const;
+
+private:
+    JNIEnv *env;
+    jvmtiEnv *jvmti;
+    std::unordered_map<jmethodID, jint> methodToIndex;
+    std::vector<jobject> methodInfos;
+};
+
 class ReferenceInfo {
 public:
     ReferenceInfo(jlong tag, jvmtiHeapReferenceKind kind);
 
-    virtual jobject getReferenceInfo(JNIEnv *env, jvmtiEnv *jvmti) { return nullptr; }
+    virtual jobject getReferenceInfo(JNIEnv *env, MethodInfoCache &methodInfos) { return nullptr; }
 
     jlong getTag() const { return tag; }
 
@@ -26,7 +49,7 @@ class InfoWithIndex : public ReferenceInfo {
 public:
     InfoWithIndex(jlong tag, jvmtiHeapReferenceKind kind, jint index);
 
-    jobject getReferenceInfo(JNIEnv *env, jvmtiEnv *jvmti) override { return toJavaArray(env, index); }
+    jobject getReferenceInfo(JNIEnv *env, MethodInfoCache &methodInfos) override { return toJavaArray(env, index); }
 
 private:
     jint index;
@@ -37,7 +60,7 @@ public:
     StackInfo(jlong tag, jvmtiHeapReferenceKind kind, jlong threadId, jint slot, jint depth, jmethodID methodId);
 
 public:
-    jobject getReferenceInfo(JNIEnv *env, jvmtiEnv *jvmti) override;
+    jobject getReferenceInfo(JNIEnv *env, MethodInfoCache &methodInfos) override;
 
 private:
     jlong threadId;
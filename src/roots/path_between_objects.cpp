@@ -0,0 +1,256 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include "path_between_objects.h"
+#include "paths_to_closest_gc_roots.h"
+#include "infos.h"
+#include "../heap_graph.h"
+
+/*
+ * Heap graph that keeps the kind and the field, array or constant pool index of every edge,
+ * so the references of the found path can be reported.
+ */
+class ReferencesHeapGraph : public HeapGraph {
+public:
+    struct EdgeInfo {
+        jvmtiHeapReferenceKind kind;
+        jint index;
+    };
+
+    ReferenceInfo *createReferenceInfo(jlong from, jlong to) const {
+        const std::vector<jlong> &neighbours = graph[from];
+        auto position = std::find(neighbours.begin(), neighbours.end(), to) - neighbours.begin();
+        const EdgeInfo &edge = edgeInfos[from][position];
+        if (edge.index < 0) {
+            return new ReferenceInfo(from, edge.kind);
+        }
+        return new InfoWithIndex(from, edge.kind, edge.index);
+    }
+
+protected:
+    void addReference(jlong from, jlong to, jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo) override {
+        addEdge(from, to);
+        edgeInfos.resize(graph.size());
+        edgeInfos[from].push_back(EdgeInfo{refKind, getReferenceIndex(refKind, refInfo)});
+    }
+
+private:
+    static jint getReferenceIndex(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo) {
+        switch (refKind) {
+            case JVMTI_HEAP_REFERENCE_STATIC_FIELD:
+            case JVMTI_HEAP_REFERENCE_FIELD:
+                return refInfo->field.index;
+            case JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT:
+                return refInfo->array.index;
+            case JVMTI_HEAP_REFERENCE_CONSTANT_POOL:
+                return refInfo->constant_pool.index;
+            default:
+                return -1;
+        }
+    }
+
+private:
+    std::vector<std::vector<EdgeInfo>> edgeInfos;
+};
+
+namespace {
+    const jint UNVISITED = -1;
+
+    // Search state of one side of the bidirectional search
+    struct SearchSide {
+        explicit SearchSide(size_t verticesCount) : distance(verticesCount, UNVISITED), parent(verticesCount, -1) {
+
+        }
+
+        void visit(jlong vertex, jlong from) {
+            distance[vertex] = from < 0 ? 0 : distance[from] + 1;
+            parent[vertex] = from;
+            next.push_back(vertex);
+        }
+
+        void advance() {
+            frontier.swap(next);
+            next.clear();
+        }
+
+        std::vector<jint> distance;
+        std::vector<jlong> parent;
+        std::vector<jlong> frontier;
+        std::vector<jlong> next;
+        jint depth = 0;
+    };
+
+    // Reverse edges are stored in the compressed sparse row format to keep them compact
+    void buildReverseEdges(const std::vector<std::vector<jlong>> &graph,
+                           std::vector<size_t> &offsets, std::vector<jlong> &edges) {
+        offsets.assign(graph.size() + 1, 0);
+        for (const auto &neighbours : graph) {
+            for (jlong to : neighbours) {
+                offsets[to + 1]++;
+            }
+        }
+        for (size_t i = 1; i < offsets.size(); i++) {
+            offsets[i] += offsets[i - 1];
+        }
+
+        edges.resize(offsets.back());
+        std::vector<size_t> positions(offsets.begin(), offsets.end() - 1);
+        for (size_t from = 0; from < graph.size(); from++) {
+            for (jlong to : graph[from]) {
+                edges[positions[to]++] = static_cast<jlong>(from);
+            }
+        }
+    }
+}
+
+PathBetweenObjectsAction::PathBetweenObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
+    referenceFilter.ignore(ReferenceFilter::JNI_REFERENCES);
+}
+
+jobjectArray PathBetweenObjectsAction::executeOperation(jobject source, jobject target, jint depthLimit) {
+    ReferencesHeapGraph heapGraph;
+    jlong sourceSize;
+    jvmtiError err = jvmti->GetObjectSize(source, &sourceSize);
+    if (!isOk(err)) return nullptr;
+
+    jlong sourceTag = heapGraph.addVertex(sourceSize);
+    err = jvmti->SetTag(source, sourceTag);
+    if (!isOk(err)) return nullptr;
+
+    // Every path from the source lies in the part of the heap reachable from it
+    progressManager.updateProgress(10, "Capturing objects reachable from the source...");
+    logger::resetTimer();
+    err = FollowReferences(0, nullptr, source, HeapGraph::captureReference, &heapGraph, "capturing objects graph");
+    logger::logPassedTime();
+    if (!isOk(err) || shouldStopExecution()) return nullptr;
+
+    jlong targetTag;
+    err = jvmti->GetTag(target, &targetTag);
+    if (!isOk(err)) return nullptr;
+
+    std::vector<jlong> path;
+    if (targetTag != 0) {
+        progressManager.updateProgress(60, "Searching for the shortest path...");
+        path = findShortestPath(heapGraph, sourceTag, targetTag, depthLimit);
+        if (shouldStopExecution()) return nullptr;
+    }
+
+    progressManager.updateProgress(90, "Packing result...");
+    return createResultObject(heapGraph, path);
+}
+
+std::vector<jlong> PathBetweenObjectsAction::findShortestPath(const ReferencesHeapGraph &heapGraph, jlong source,
+                                                             jlong target, jint depthLimit) {
+    if (source == target) {
+        return std::vector<jlong>{source};
+    }
+
+    const std::vector<std::vector<jlong>> &graph = heapGraph.graph;
+    std::vector<size_t> reverseOffsets;
+    std::vector<jlong> reverseEdges;
+    buildReverseEdges(graph, reverseOffsets, reverseEdges);
+
+    SearchSide forward(graph.size());
+    SearchSide backward(graph.size());
+    forward.visit(source, -1);
+    forward.advance();
+    backward.visit(target, -1);
+    backward.advance();
+
+    jlong meeting = -1;
+    jint bestLength = -1;
+    while (meeting == -1 && !forward.frontier.empty() && !backward.frontier.empty()) {
+        if (depthLimit >= 0 && forward.depth + backward.depth >= depthLimit) break;
+        if (shouldStopExecution()) return {};
+
+        // Expand a whole level of the smaller frontier, so the first meeting level gives the shortest path
+        bool expandForward = forward.frontier.size() <= backward.frontier.size();
+        SearchSide &current = expandForward ? forward : backward;
+        SearchSide &other = expandForward ? backward : forward;
+        for (jlong vertex : current.frontier) {
+            auto relax = [&](jlong neighbour) {
+                if (current.distance[neighbour] != UNVISITED) return;
+                current.visit(neighbour, vertex);
+                if (other.distance[neighbour] != UNVISITED) {
+                    jint length = current.distance[neighbour] + other.distance[neighbour];
+                    if (bestLength == -1 || length < bestLength) {
+                        bestLength = length;
+                        meeting = neighbour;
+                    }
+                }
+            };
+
+            if (expandForward) {
+                for (jlong neighbour : graph[vertex]) {
+                    relax(neighbour);
+                }
+            } else {
+                for (size_t i = reverseOffsets[vertex]; i < reverseOffsets[vertex + 1]; i++) {
+                    relax(reverseEdges[i]);
+                }
+            }
+        }
+        current.advance();
+        current.depth++;
+    }
+
+    if (meeting == -1 || (depthLimit >= 0 && bestLength > depthLimit)) {
+        return {};
+    }
+
+    std::vector<jlong> path;
+    for (jlong vertex = meeting; vertex != -1; vertex = forward.parent[vertex]) {
+        path.push_back(vertex);
+    }
+    std::reverse(path.begin(), path.end());
+    for (jlong vertex = backward.parent[meeting]; vertex != -1; vertex = backward.parent[vertex]) {
+        path.push_back(vertex);
+    }
+    return path;
+}
+
+jobjectArray PathBetweenObjectsAction::createResultObject(const ReferencesHeapGraph &heapGraph, const std::vector<jlong> &path) {
+    std::vector<std::pair<jobject, jlong>> objectToTag;
+    if (!path.empty()) {
+        jvmtiError err = getObjectsByTags(jvmti, std::vector<jlong>(path), objectToTag);
+        if (!isOk(err)) return nullptr;
+    }
+
+    std::unordered_map<jlong, jobject> tagToObject;
+    for (auto &entry : objectToTag) {
+        tagToObject[entry.second] = entry.first;
+    }
+
+    jclass langObject = env->FindClass("java/lang/Object");
+    auto objectsCount = static_cast<jsize>(path.size());
+    jobjectArray objects = env->NewObjectArray(objectsCount, langObject, nullptr);
+    jobjectArray links = env->NewObjectArray(objectsCount, langObject, nullptr);
+    std::unordered_map<jlong, jint> tagToIndex;
+    MethodInfoCache methodInfos(env, jvmti);
+    for (jsize i = 0; i < objectsCount; i++) {
+        env->SetObjectArrayElement(objects, i, tagToObject[path[i]]);
+        tagToIndex[path[i]] = i;
+
+        std::vector<ReferenceInfo *> infos;
+        std::unique_ptr<ReferenceInfo> info;
+        if (i > 0) {
+            info.reset(heapGraph.createReferenceInfo(path[i - 1], path[i]));
+            infos.push_back(info.get());
+        }
+        env->SetObjectArrayElement(links, i, createLinksInfos(env, methodInfos, tagToIndex, infos));
+    }
+
+    std::vector<jboolean> weakSoftReachable(objectsCount);
+    jobjectArray result = env->NewObjectArray(4, langObject, nullptr);
+    env->SetObjectArrayElement(result, 0, objects);
+    env->SetObjectArrayElement(result, 1, links);
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, weakSoftReachable));
+    env->SetObjectArrayElement(result, 3, methodInfos.toJavaArray());
+    return result;
+}
+
+jvmtiError PathBetweenObjectsAction::cleanHeap() {
+    return removeAllTagsFromHeap(jvmti, nullptr);
+}
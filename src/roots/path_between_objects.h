@@ -0,0 +1,25 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_PATH_BETWEEN_OBJECTS_H
+#define MEMORY_AGENT_PATH_BETWEEN_OBJECTS_H
+
+#include <vector>
+#include "../memory_agent_action.h"
+
+// Forward declaration
+class ReferencesHeapGraph;
+
+class PathBetweenObjectsAction : public MemoryAgentAction<jobjectArray, jobject, jobject, jint> {
+public:
+    PathBetweenObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobject source, jobject target, jint depthLimit) override;
+    jvmtiError cleanHeap() override;
+
+    std::vector<jlong> findShortestPath(const ReferencesHeapGraph &heapGraph, jlong source, jlong target, jint depthLimit);
+
+    jobjectArray createResultObject(const ReferencesHeapGraph &heapGraph, const std::vector<jlong> &path);
+};
+
+#endif //MEMORY_AGENT_PATH_BETWEEN_OBJECTS_H
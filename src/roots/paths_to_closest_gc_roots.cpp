@@ -34,36 +34,6 @@ namespace {
         return JVMTI_VISIT_OBJECTS;
     }
 
-    jobjectArray createLinksInfos(JNIEnv *env, jvmtiEnv *jvmti,
-                                  const std::unordered_map<jlong, jint> &tagToIndex,
-                                  const std::vector<ReferenceInfo *> &infos) {
-        std::vector<jint> prevIndices;
-        std::vector<jint> refKinds;
-        std::vector<jobject> refInfos;
-
-        size_t size = infos.size();
-        prevIndices.reserve(size);
-        refInfos.reserve(size);
-        refKinds.reserve(size);
-        for (ReferenceInfo *info : infos) {
-            jlong prevTag = info->getTag();
-            auto it = tagToIndex.find(prevTag);
-            if (prevTag != -1 && it == tagToIndex.end()) {
-                continue;
-            }
-            prevIndices.push_back(prevTag == -1 ? -1 : it->second);
-            refKinds.push_back(static_cast<jint>(info->getKind()));
-            refInfos.push_back(info->getReferenceInfo(env, jvmti));
-        }
-
-        jobjectArray result = env->NewObjectArray(4, env->FindClass("java/lang/Object"), nullptr);
-        env->SetObjectArrayElement(result, 0, toJavaArray(env, prevIndices));
-        env->SetObjectArrayElement(result, 1, toJavaArray(env, refKinds));
-        env->SetObjectArrayElement(result, 2, toJavaArray(env, refInfos));
-
-        return result;
-    }
-
     std::vector<std::pair<jobject, jlong>> getObjectToTag(jvmtiEnv *jvmti, std::vector<jlong> &tags) {
         std::vector<std::pair<jobject, jlong>> objectToTag;
         jvmtiError err = getObjectsByTags(jvmti, tags, objectToTag);
@@ -90,21 +60,23 @@ namespace {
         jobjectArray resultObjects = env->NewObjectArray(objectsCount, langObject, nullptr);
         jobjectArray links = env->NewObjectArray(objectsCount, langObject, nullptr);
         std::vector<jboolean> weakSoftReachable(objectsCount);
+        MethodInfoCache methodInfos(env, jvmti);
 
         for (jsize i = 0; i < objectsCount; ++i) {
             env->SetObjectArrayElement(resultObjects, i, objectToTag[i].first);
             jlong tag = objectToTag[i].second;
             auto infos = tagToInfos == nullptr ?
-                         createLinksInfos(env, jvmti, tagToIndex, GcTag::pointerToGcTag(tag)->backRefs) :
-                         createLinksInfos(env, jvmti, tagToIndex, (*tagToInfos).find(tag)->second);
+                         createLinksInfos(env, methodInfos, tagToIndex, GcTag::pointerToGcTag(tag)->backRefs) :
+                         createLinksInfos(env, methodInfos, tagToIndex, (*tagToInfos).find(tag)->second);
             env->SetObjectArrayElement(links, i, infos);
             weakSoftReachable[i] = GcTag::pointerToGcTag(tag)->isWeakSoftReachable();
         }
 
-        jobjectArray result = env->NewObjectArray(3, langObject, nullptr);
+        jobjectArray result = env->NewObjectArray(4, langObject, nullptr);
         env->SetObjectArrayElement(result, 0, resultObjects);
         env->SetObjectArrayElement(result, 1, links);
         env->SetObjectArrayElement(result, 2, toJavaArray(env, weakSoftReachable));
+        env->SetObjectArrayElement(result, 3, methodInfos.toJavaArray());
 
         return result;
     }
@@ -246,6 +218,36 @@ namespace {
     }
 }
 
+jobjectArray createLinksInfos(JNIEnv *env, MethodInfoCache &methodInfos,
+                              const std::unordered_map<jlong, jint> &tagToIndex,
+                              const std::vector<ReferenceInfo *> &infos) {
+    std::vector<jint> prevIndices;
+    std::vector<jint> refKinds;
+    std::vector<jobject> refInfos;
+
+    size_t size = infos.size();
+    prevIndices.reserve(size);
+    refInfos.reserve(size);
+    refKinds.reserve(size);
+    for (ReferenceInfo *info : infos) {
+        jlong prevTag = info->getTag();
+        auto it = tagToIndex.find(prevTag);
+        if (prevTag != -1 && it == tagToIndex.end()) {
+            continue;
+        }
+        prevIndices.push_back(prevTag == -1 ? -1 : it->second);
+        refKinds.push_back(static_cast<jint>(info->getKind()));
+        refInfos.push_back(info->getReferenceInfo(env, methodInfos));
+    }
+
+    jobjectArray result = env->NewObjectArray(4, env->FindClass("java/lang/Object"), nullptr);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, prevIndices));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, refKinds));
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, refInfos));
+
+    return result;
+}
+
 PathsToClosestGcRootsAction::PathsToClosestGcRootsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
 
 }
@@ -294,25 +296,12 @@ void setTagsForReferences(JNIEnv *env, jvmtiEnv *jvmti, jlong tag) {
             "java/lang/ref/WeakReference",
             "java/lang/ref/PhantomReference"
     };
-    jclass refClasses[3];
-    for (int i = 0; i < 3; i++) {
-        refClasses[i] = env->FindClass(refClassesNames[i]);
-    }
 
-    jclass *classes;
-    jint cnt;
-    jvmtiError err = jvmti->GetLoadedClasses(&cnt, &classes);
-    handleError(jvmti, err, "Couldn't get loaded classes");
-    jmethodID isAssignableFrom = getIsAssignableFromMethod(env);
-
-    for (int i = 0; i < cnt; i++) {
-        for (auto & refClass : refClasses) {
-            if (env->CallBooleanMethod(refClass, isAssignableFrom, classes[i])) {
-                err = jvmti->SetTag(classes[i], tag);
-                handleError(jvmti, err, "Couldn't set tag for reference class");
-                break;
-            }
-        }
+    for (const char *refClassName : refClassesNames) {
+        jvmtiError err = tagClassAndItsInheritors(env, jvmti, env->FindClass(refClassName), [tag](jlong oldTag) {
+            return tag;
+        });
+        handleError(jvmti, err, "Couldn't set tag for reference class");
     }
 }
 
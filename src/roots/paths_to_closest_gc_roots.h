@@ -3,6 +3,7 @@
 #ifndef MEMORY_AGENT_PATHS_TO_CLOSEST_GC_ROOTS_H
 #define MEMORY_AGENT_PATHS_TO_CLOSEST_GC_ROOTS_H
 
+#include <unordered_map>
 #include "../memory_agent_action.h"
 #include "roots_tags.h"
 
@@ -23,4 +24,8 @@ private:
 
 void setTagsForReferences(JNIEnv *env, jvmtiEnv *jvmti, jlong tag);
 
+jobjectArray createLinksInfos(JNIEnv *env, MethodInfoCache &methodInfos,
+                              const std::unordered_map<jlong, jint> &tagToIndex,
+                              const std::vector<ReferenceInfo *> &infos);
+
 #endif //MEMORY_AGENT_PATHS_TO_CLOSEST_GC_ROOTS_H
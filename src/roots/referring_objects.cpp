@@ -0,0 +1,135 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include "referring_objects.h"
+#include "infos.h"
+
+#define MOCK_REFERRER_TAG (-1)
+
+namespace {
+    struct ReferrerEdge {
+        ReferrerEdge(jint targetIndex, ReferenceInfo *info) : targetIndex(targetIndex), info(info) {
+
+        }
+
+        jint targetIndex;
+        std::unique_ptr<ReferenceInfo> info;
+    };
+
+    /*
+     * Targets are tagged with 1..targetsCount, referrers get tags after them when the first
+     * reference to a target is reported. Objects that don't refer to targets are never tagged.
+     */
+    struct ReferrersInfo {
+        explicit ReferrersInfo(jlong targetsCount) : targetsCount(targetsCount), nextReferrerTag(targetsCount + 1) {
+
+        }
+
+        const jlong targetsCount;
+        jlong nextReferrerTag;
+        std::vector<ReferrerEdge> edges;
+    };
+
+    jint JNICALL collectReferrers(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                                  jlong referrerClassTag, jlong size, jlong *tagPtr,
+                                  jlong *referrerTagPtr, jint length, void *userData) {
+        auto *info = reinterpret_cast<ReferrersInfo *>(userData);
+        if (*tagPtr <= 0 || *tagPtr > info->targetsCount) {
+            return JVMTI_VISIT_OBJECTS;
+        }
+
+        jlong referrerTag = -1;
+        if (referrerTagPtr != nullptr) {
+            if (*referrerTagPtr == MOCK_REFERRER_TAG) {
+                return JVMTI_VISIT_OBJECTS;
+            } else if (*referrerTagPtr == 0) {
+                *referrerTagPtr = info->nextReferrerTag++;
+            }
+            referrerTag = *referrerTagPtr;
+        }
+
+        info->edges.emplace_back(static_cast<jint>(*tagPtr - 1), createReferenceInfo(referrerTag, refKind, refInfo));
+        return JVMTI_VISIT_OBJECTS;
+    }
+
+    jobjectArray createResultObject(JNIEnv *env, jvmtiEnv *jvmti, const ReferrersInfo &info, jint offset, jint limit) {
+        size_t begin = std::min(static_cast<size_t>(std::max(offset, 0)), info.edges.size());
+        size_t end = std::min(begin + static_cast<size_t>(std::max(limit, 0)), info.edges.size());
+
+        std::vector<jlong> referrerTags;
+        for (size_t i = begin; i < end; i++) {
+            jlong tag = info.edges[i].info->getTag();
+            if (tag != -1) {
+                referrerTags.push_back(tag);
+            }
+        }
+
+        std::vector<std::pair<jobject, jlong>> objectToTag;
+        jvmtiError err = getObjectsByTags(jvmti, referrerTags, objectToTag);
+        handleError(jvmti, err, "Could not receive referrers by their tags");
+        std::unordered_map<jlong, jobject> tagToObject;
+        for (auto &entry : objectToTag) {
+            tagToObject[entry.second] = entry.first;
+        }
+
+        jclass langObject = env->FindClass("java/lang/Object");
+        auto pageSize = static_cast<jsize>(end - begin);
+        jobjectArray referrers = env->NewObjectArray(pageSize, langObject, nullptr);
+        std::vector<jint> targetIndices;
+        std::vector<jint> refKinds;
+        std::vector<jobject> refInfos;
+        MethodInfoCache methodInfos(env, jvmti);
+        for (size_t i = begin; i < end; i++) {
+            const ReferrerEdge &edge = info.edges[i];
+            auto it = tagToObject.find(edge.info->getTag());
+            if (it != tagToObject.end()) {
+                env->SetObjectArrayElement(referrers, static_cast<jsize>(i - begin), it->second);
+            }
+            targetIndices.push_back(edge.targetIndex);
+            refKinds.push_back(static_cast<jint>(edge.info->getKind()));
+            refInfos.push_back(edge.info->getReferenceInfo(env, methodInfos));
+        }
+
+        jobjectArray result = env->NewObjectArray(6, langObject, nullptr);
+        env->SetObjectArrayElement(result, 0, referrers);
+        env->SetObjectArrayElement(result, 1, toJavaArray(env, targetIndices));
+        env->SetObjectArrayElement(result, 2, toJavaArray(env, refKinds));
+        env->SetObjectArrayElement(result, 3, toJavaArray(env, refInfos));
+        env->SetObjectArrayElement(result, 4, toJavaArray(env, static_cast<jint>(info.edges.size())));
+        env->SetObjectArrayElement(result, 5, methodInfos.toJavaArray());
+        return result;
+    }
+}
+
+ReferringObjectsAction::ReferringObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
+    // JNI references are not referrers, but objects behind them are still visited
+    referenceFilter.hide(ReferenceFilter::JNI_REFERENCES);
+}
+
+jobjectArray ReferringObjectsAction::executeOperation(jobjectArray objects, jint offset, jint limit) {
+    jsize targetsCount = env->GetArrayLength(objects);
+    for (jsize i = 0; i < targetsCount; i++) {
+        jvmtiError err = jvmti->SetTag(env->GetObjectArrayElement(objects, i), i + 1);
+        if (!isOk(err)) return nullptr;
+    }
+
+    // We set a tag for the input array to ignore it during traversal
+    jvmtiError err = jvmti->SetTag(objects, MOCK_REFERRER_TAG);
+    if (!isOk(err)) return nullptr;
+
+    ReferrersInfo info(targetsCount);
+    progressManager.updateProgress(10, "Collecting referrers...");
+    logger::resetTimer();
+    err = FollowReferences(0, nullptr, nullptr, collectReferrers, &info, "collecting referrers");
+    logger::logPassedTime();
+    if (!isOk(err) || shouldStopExecution()) return nullptr;
+
+    progressManager.updateProgress(90, "Packing result...");
+    return createResultObject(env, jvmti, info, offset, limit);
+}
+
+jvmtiError ReferringObjectsAction::cleanHeap() {
+    return removeAllTagsFromHeap(jvmti, nullptr);
+}
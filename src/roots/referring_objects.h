@@ -0,0 +1,17 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_REFERRING_OBJECTS_H
+#define MEMORY_AGENT_REFERRING_OBJECTS_H
+
+#include "../memory_agent_action.h"
+
+class ReferringObjectsAction : public MemoryAgentAction<jobjectArray, jobjectArray, jint, jint> {
+public:
+    ReferringObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobjectArray objects, jint offset, jint limit) override;
+    jvmtiError cleanHeap() override;
+};
+
+#endif //MEMORY_AGENT_REFERRING_OBJECTS_H
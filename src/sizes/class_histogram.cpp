@@ -0,0 +1,90 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <algorithm>
+#include "class_histogram.h"
+
+struct ClassHistogram {
+    explicit ClassHistogram(size_t classesCount) : counts(classesCount, 0), sizes(classesCount, 0) {}
+
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+};
+
+static jint JNICALL countObject(jlong classTag, jlong size, jlong *tagPtr, jint length, void *userData) {
+    auto *histogram = reinterpret_cast<ClassHistogram *>(userData);
+    auto index = static_cast<size_t>(classTag - 1);
+    histogram->counts[index]++;
+    histogram->sizes[index] += size;
+    return JVMTI_VISIT_OBJECTS;
+}
+
+ClassHistogramAction::ClassHistogramAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
+
+}
+
+jobjectArray ClassHistogramAction::executeOperation(jint classesLimit) {
+    jint classesCount;
+    jclass *classesPtr;
+    jvmtiError err = jvmti->GetLoadedClasses(&classesCount, &classesPtr);
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not get loaded classes");
+        return nullptr;
+    }
+    classes.assign(classesPtr, classesPtr + classesCount);
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(classesPtr));
+
+    progressManager.updateProgress(10, "Tagging classes...");
+    for (size_t i = 0; i < classes.size(); i++) {
+        err = jvmti->SetTag(classes[i], static_cast<jlong>(i + 1));
+        if (!isOk(err)) {
+            handleError(jvmti, err, "Could not tag class");
+            return nullptr;
+        }
+    }
+
+    progressManager.updateProgress(20, "Counting objects...");
+    ClassHistogram histogram(classes.size());
+    err = IterateThroughHeap(JVMTI_HEAP_FILTER_CLASS_UNTAGGED, nullptr, countObject, &histogram, "count objects of classes");
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not count objects of classes");
+        return nullptr;
+    }
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i < classes.size(); i++) {
+        if (histogram.counts[i] > 0) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&histogram](size_t a, size_t b) {
+        return histogram.sizes[a] > histogram.sizes[b];
+    });
+    if (classesLimit >= 0 && order.size() > static_cast<size_t>(classesLimit)) {
+        order.resize(static_cast<size_t>(classesLimit));
+    }
+
+    std::vector<jobject> resultClasses;
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+    for (size_t index : order) {
+        resultClasses.push_back(classes[index]);
+        counts.push_back(histogram.counts[index]);
+        sizes.push_back(histogram.sizes[index]);
+    }
+
+    jobjectArray result = env->NewObjectArray(3, env->FindClass("java/lang/Object"), nullptr);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, resultClasses));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, counts));
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, sizes));
+    return result;
+}
+
+jvmtiError ClassHistogramAction::cleanHeap() {
+    // only classes were tagged
+    jvmtiError err = JVMTI_ERROR_NONE;
+    for (jclass klass : classes) {
+        jvmtiError classErr = jvmti->SetTag(klass, 0);
+        if (err == JVMTI_ERROR_NONE) err = classErr;
+    }
+    return err;
+}
@@ -0,0 +1,24 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_CLASS_HISTOGRAM_H
+#define MEMORY_AGENT_CLASS_HISTOGRAM_H
+
+#include <vector>
+#include "../memory_agent_action.h"
+
+/*
+ * Instances count and shallow size of every loaded class, like jmap -histo.
+ * Classes are sorted by shallow size, at most classesLimit of them are returned (all if negative).
+ */
+class ClassHistogramAction : public MemoryAgentAction<jobjectArray, jint> {
+public:
+    ClassHistogramAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jint classesLimit) override;
+    jvmtiError cleanHeap() override;
+
+    std::vector<jclass> classes;
+};
+
+#endif //MEMORY_AGENT_CLASS_HISTOGRAM_H
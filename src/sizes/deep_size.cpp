@@ -0,0 +1,247 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <algorithm>
+#include <numeric>
+#include "deep_size.h"
+
+/*
+ * Loaded classes are tagged with -(index + 1), other reached objects with their vertex number + 1,
+ * the start object is vertex 0. FollowReferences expands every object only once, in DFS order,
+ * so with a depth limit the subgraph is captured first and depths are calculated with a BFS.
+ * Without a limit every reached object is counted right away.
+ */
+struct DeepSizeInfo {
+    DeepSizeInfo(jlong startTag, jint depthLimit, size_t classesCount) :
+        startTag(startTag), depthLimit(depthLimit), counts(classesCount, 0), sizes(classesCount, 0),
+        classVertices(classesCount, -1) {
+
+    }
+
+    void addObject(jlong classTag, jlong size) {
+        if (classTag < 0) {
+            auto index = static_cast<size_t>(-classTag - 1);
+            counts[index]++;
+            sizes[index] += size;
+        } else {
+            otherCount++;
+            otherSize += size;
+        }
+    }
+
+    jlong addVertex(jlong classTag, jlong size) {
+        if (depthLimit < 0) {
+            addObject(classTag, size);
+            return vertexCount++;
+        }
+        graph.emplace_back();
+        vertexClassTags.push_back(classTag);
+        vertexSizes.push_back(size);
+        return vertexCount++;
+    }
+
+    void addEdge(jlong from, jlong to) {
+        if (depthLimit >= 0) {
+            graph[from].push_back(to);
+        }
+    }
+
+    void countObjectsWithinDepthLimit() {
+        std::vector<jint> depths(graph.size(), -1);
+        std::vector<jlong> queue{0};
+        depths[0] = 0;
+        for (size_t i = 0; i < queue.size(); i++) {
+            jlong vertex = queue[i];
+            addObject(vertexClassTags[vertex], vertexSizes[vertex]);
+            if (depths[vertex] == depthLimit) continue;
+
+            for (jlong neighbour : graph[vertex]) {
+                if (depths[neighbour] == -1) {
+                    depths[neighbour] = depths[vertex] + 1;
+                    queue.push_back(neighbour);
+                }
+            }
+        }
+    }
+
+    jlong startTag;
+    jint depthLimit;
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+    jlong otherCount = 0;
+    jlong otherSize = 0;
+    jlong vertexCount = 0;
+    std::vector<jlong> classVertices;
+    std::vector<std::vector<jlong>> graph;
+    std::vector<jlong> vertexClassTags;
+    std::vector<jlong> vertexSizes;
+};
+
+static bool isClassMetadataReference(jvmtiHeapReferenceKind refKind, const jlong *referrerTagPtr, jlong startTag) {
+    if (refKind == JVMTI_HEAP_REFERENCE_STATIC_FIELD) {
+        // static fields are only followed from the start object
+        return referrerTagPtr == nullptr || *referrerTagPtr != startTag;
+    }
+    return (ReferenceFilter::kindBit(refKind) & ReferenceFilter::CLASS_METADATA_REFERENCES) != 0;
+}
+
+static jint JNICALL captureDeepSizeGraph(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                                         jlong referrerClassTag, jlong size, jlong *tagPtr,
+                                         jlong *referrerTagPtr, jint length, void *userData) {
+    auto *info = reinterpret_cast<DeepSizeInfo *>(userData);
+    if (referrerTagPtr == nullptr || isClassMetadataReference(refKind, referrerTagPtr, info->startTag)) {
+        return 0;
+    }
+
+    // only the start object and objects tagged with vertex numbers are expanded
+    jlong from = *referrerTagPtr == info->startTag ? 0 : *referrerTagPtr - 1;
+    if (*tagPtr == info->startTag) {
+        info->addEdge(from, 0);
+        return 0;
+    }
+
+    if (*tagPtr < 0) {
+        // a class object referenced from a field is counted, its statics are not
+        auto index = static_cast<size_t>(-*tagPtr - 1);
+        if (info->classVertices[index] == -1) {
+            info->classVertices[index] = info->addVertex(classTag, size);
+        }
+        info->addEdge(from, info->classVertices[index]);
+        return 0;
+    }
+
+    if (*tagPtr == 0) {
+        jlong vertex = info->addVertex(classTag, size);
+        *tagPtr = vertex + 1;
+        info->addEdge(from, vertex);
+        return JVMTI_VISIT_OBJECTS;
+    }
+
+    info->addEdge(from, *tagPtr - 1);
+    return 0;
+}
+
+static jint JNICALL clearDeepSizeTags(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                                      jlong referrerClassTag, jlong size, jlong *tagPtr,
+                                      jlong *referrerTagPtr, jint length, void *userData) {
+    if (referrerTagPtr == nullptr || isClassMetadataReference(refKind, referrerTagPtr, *reinterpret_cast<jlong *>(userData))) {
+        return 0;
+    }
+
+    // classes and already cleared objects are not expanded
+    if (*tagPtr <= 0) {
+        return 0;
+    }
+    *tagPtr = 0;
+    return JVMTI_VISIT_OBJECTS;
+}
+
+DeepSizeAction::DeepSizeAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object), startObject(nullptr) {
+
+}
+
+jvmtiError DeepSizeAction::tagLoadedClasses() {
+    jint classesCount;
+    jclass *loadedClasses;
+    jvmtiError err = jvmti->GetLoadedClasses(&classesCount, &loadedClasses);
+    if (err != JVMTI_ERROR_NONE) return err;
+
+    classes.assign(loadedClasses, loadedClasses + classesCount);
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(loadedClasses));
+    for (size_t i = 0; i < classes.size() && err == JVMTI_ERROR_NONE; i++) {
+        err = jvmti->SetTag(classes[i], -static_cast<jlong>(i + 1));
+    }
+    return err;
+}
+
+jobjectArray DeepSizeAction::executeOperation(jobject object, jint depthLimit) {
+    jvmtiError err = tagLoadedClasses();
+    handleError(jvmti, err, "Couldn't tag loaded classes");
+    if (err != JVMTI_ERROR_NONE) return nullptr;
+
+    jlong startTag;
+    jlong startSize;
+    jlong startClassTag;
+    // Checked first, a null object would make FollowReferences walk the whole heap
+    err = jvmti->GetObjectSize(object, &startSize);
+    handleError(jvmti, err, "Couldn't get size of the object");
+    if (err != JVMTI_ERROR_NONE) return nullptr;
+
+    startObject = object;
+    jclass startClass = env->GetObjectClass(object);
+    err = jvmti->GetTag(startClass, &startClassTag);
+    env->DeleteLocalRef(startClass);
+    if (err == JVMTI_ERROR_NONE) {
+        err = jvmti->GetTag(object, &startTag);
+    }
+    if (err == JVMTI_ERROR_NONE && startTag == 0) {
+        startTag = 1;
+        err = jvmti->SetTag(object, startTag);
+    }
+    handleError(jvmti, err, "Couldn't tag the object");
+    if (err != JVMTI_ERROR_NONE) return nullptr;
+
+    DeepSizeInfo info(startTag, depthLimit, classes.size());
+    info.addVertex(startClassTag, startSize);
+
+    progressManager.updateProgress(10, "Calculating deep size...");
+    err = FollowReferences(0, nullptr, object, captureDeepSizeGraph, &info, "calculate deep size");
+    handleError(jvmti, err, "Couldn't calculate deep size");
+    if (err != JVMTI_ERROR_NONE) return nullptr;
+
+    if (depthLimit >= 0) {
+        progressManager.updateProgress(80, "Calculating depths...");
+        info.countObjectsWithinDepthLimit();
+    }
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i < classes.size(); i++) {
+        if (info.counts[i] > 0) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&info](size_t a, size_t b) {
+        return info.sizes[a] > info.sizes[b];
+    });
+
+    std::vector<jobject> resultClasses;
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+    for (size_t index : order) {
+        resultClasses.push_back(classes[index]);
+        counts.push_back(info.counts[index]);
+        sizes.push_back(info.sizes[index]);
+    }
+    jlong totalCount = std::accumulate(counts.begin(), counts.end(), info.otherCount);
+    jlong totalSize = std::accumulate(sizes.begin(), sizes.end(), info.otherSize);
+
+    std::vector<jlong> total{totalSize, totalCount};
+
+    jobjectArray result = env->NewObjectArray(4, env->FindClass("java/lang/Object"), nullptr);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, total));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, resultClasses));
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, counts));
+    env->SetObjectArrayElement(result, 3, toJavaArray(env, sizes));
+    return result;
+}
+
+jvmtiError DeepSizeAction::cleanHeap() {
+    jvmtiError err = JVMTI_ERROR_NONE;
+    if (startObject != nullptr) {
+        // only the subgraph of the start object was tagged, so there is no need to iterate the whole heap
+        jlong startTag;
+        jvmti->GetTag(startObject, &startTag);
+        jvmtiHeapCallbacks cb;
+        std::memset(&cb, 0, sizeof(jvmtiHeapCallbacks));
+        cb.heap_reference_callback = clearDeepSizeTags;
+        err = jvmti->FollowReferences(0, nullptr, startObject, &cb, &startTag);
+        if (startTag > 0) {
+            jvmti->SetTag(startObject, 0);
+        }
+    }
+
+    for (jclass klass : classes) {
+        jvmtiError classErr = jvmti->SetTag(klass, 0);
+        if (err == JVMTI_ERROR_NONE) err = classErr;
+    }
+    return err;
+}
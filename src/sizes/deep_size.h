@@ -0,0 +1,28 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_DEEP_SIZE_H
+#define MEMORY_AGENT_DEEP_SIZE_H
+
+#include <vector>
+#include "../memory_agent_action.h"
+
+/*
+ * Calculates the total size of objects reachable from the given object, shared ones included,
+ * with a single FollowReferences call from that object. Class metadata references are not followed
+ * and objects deeper than depthLimit (negative means unlimited) are not counted.
+ */
+class DeepSizeAction : public MemoryAgentAction<jobjectArray, jobject, jint> {
+public:
+    DeepSizeAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobject object, jint depthLimit) override;
+    jvmtiError cleanHeap() override;
+
+    jvmtiError tagLoadedClasses();
+
+    jobject startObject;
+    std::vector<jclass> classes;
+};
+
+#endif //MEMORY_AGENT_DEEP_SIZE_H
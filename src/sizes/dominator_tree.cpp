@@ -11,51 +11,74 @@ namespace {
         ancestor[w] = v;
     }
 
-    void compress(jlong v, jlongs &ancestor, jlongs &label, jlongs &semi) {
-        if (ancestor[ancestor[v]] != -1) {
-            compress(ancestor[v], ancestor, label, semi);
-            if (semi[label[ancestor[v]]] < semi[label[v]]) {
-                label[v] = label[ancestor[v]];
+    // Both compress and dfs are iterative: a whole-heap graph easily has paths
+    // that are millions of vertices long, which would overflow the native stack.
+    void compress(jlong v, jlongs &ancestor, jlongs &label, jlongs &semi, jlongs &path) {
+        path.clear();
+        while (ancestor[ancestor[v]] != -1) {
+            path.push_back(v);
+            v = ancestor[v];
+        }
+
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            jlong u = *it;
+            if (semi[label[ancestor[u]]] < semi[label[u]]) {
+                label[u] = label[ancestor[u]];
             }
-            ancestor[v] = ancestor[ancestor[v]];
+            ancestor[u] = ancestor[ancestor[u]];
         }
     }
 
-    jlong eval(jlong v, jlongs &ancestor, jlongs &label, jlongs &semi) {
+    jlong eval(jlong v, jlongs &ancestor, jlongs &label, jlongs &semi, jlongs &path) {
         if (ancestor[v] == -1) {
             return v;
         }
-        compress(v, ancestor, label, semi);
+        compress(v, ancestor, label, semi, path);
         
         return label[v];
     }
 
-    void dfs(jlong v, jlong &n, const graph_t &graph, jlongs &semi,
+    void dfs(jlong root, jlong &n, const graph_t &graph, jlongs &semi,
              jlongs &parent, jlongs &vertex, graph_t &pred) {
-        semi[v] = n;
-        vertex[n] = v;
+        std::vector<std::pair<jlong, size_t>> stack;
+        semi[root] = n;
+        vertex[n] = root;
         n++;
-        for (jlong w : graph[v]) {
+        stack.emplace_back(root, 0);
+        while (!stack.empty()) {
+            jlong v = stack.back().first;
+            size_t i = stack.back().second;
+            if (i == graph[v].size()) {
+                stack.pop_back();
+                continue;
+            }
+            stack.back().second++;
+
+            jlong w = graph[v][i];
+            pred[w].push_back(v);
             if (w != 0 && semi[w] == 0) {
                 parent[w] = v;
-                dfs(w, n, graph, semi, parent, vertex, pred);
+                semi[w] = n;
+                vertex[n] = w;
+                n++;
+                stack.emplace_back(w, 0);
             }
-            pred[w].push_back(v);
         }
     }
 }
 
-jlongs calculateRetainedSizesViaDominatorTree(const graph_t &graph, const jlongs &sizes) {
+jlongs calculateRetainedSizesViaDominatorTree(const graph_t &graph, const jlongs &sizes, jlongs *dominators) {
     auto n = static_cast<jlong>(graph.size());
     jlongs semi(n);
     jlongs parent(n);
     jlongs vertex(n);
     jlongs ancestor(n);
     jlongs label(n);
-    jlongs dom(n);
+    jlongs dom(n, -1);
     jlongs retainedSizes(n);
     graph_t pred(n);
     graph_t bucket(n);
+    jlongs path;
 
     for (jlong i = 0; i < n; i++) {
         retainedSizes[i] = sizes[i];
@@ -69,7 +92,7 @@ jlongs calculateRetainedSizesViaDominatorTree(const graph_t &graph, const jlongs
     for (jlong i = n - 1; i > 0; i--) {
         jlong w = vertex[i];
         for (jlong v : pred[w]) {
-            jlong u = eval(v, ancestor, label, semi);
+            jlong u = eval(v, ancestor, label, semi, path);
             if (semi[u] < semi[w]) {
                 semi[w] = semi[u];
             }
@@ -78,7 +101,7 @@ jlongs calculateRetainedSizesViaDominatorTree(const graph_t &graph, const jlongs
         link(parent[w], w, ancestor);
 
         for (jlong v : bucket[parent[w]]) {
-            jlong u = eval(v, ancestor, label, semi);
+            jlong u = eval(v, ancestor, label, semi, path);
             if (semi[u] < semi[v]) {
                 dom[v] = u;
             } else {
@@ -89,7 +112,9 @@ jlongs calculateRetainedSizesViaDominatorTree(const graph_t &graph, const jlongs
     }
 
     dom[0] = -1;
-    jlongs childCount(n);
+    // Vertices unreachable from the master root are not numbered by dfs,
+    // so child counts are indexed by vertex and only numbered vertices are visited
+    jlongs childCount(graph.size());
     for (jlong i = 1; i < n; i++) {
         jlong w = vertex[i];
         if (dom[w] != vertex[semi[w]]) {
@@ -101,10 +126,14 @@ jlongs calculateRetainedSizesViaDominatorTree(const graph_t &graph, const jlongs
         }
     }
 
+    if (dominators != nullptr) {
+        *dominators = dom;
+    }
+
     std::queue<jlong> leaves;
     for (jlong i = 1; i < n; i++) {
-        if (childCount[i] == 0) {
-            leaves.push(i);
+        if (childCount[vertex[i]] == 0) {
+            leaves.push(vertex[i]);
         }
     }
 
@@ -6,7 +6,10 @@
 #include <vector>
 #include <jni.h>
 
+// If dominators is not null, it is filled with the immediate dominator of every vertex,
+// -1 for the root and for vertices unreachable from it
 std::vector<jlong> calculateRetainedSizesViaDominatorTree(const std::vector<std::vector<jlong>> &graph,
-                                                          const std::vector<jlong> &sizes);
+                                                          const std::vector<jlong> &sizes,
+                                                          std::vector<jlong> *dominators=nullptr);
 
 #endif //MEMORY_AGENT_DOMINATOR_TREE_H
@@ -34,8 +34,7 @@ static bool tagsAreValidForMerge(jlong referree, jlong referrer) {
 jint JNICALL getTagsWithNewInfo(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
                                 jlong referrerClassTag, jlong size, jlong *tagPtr,
                                 jlong *referrerTagPtr, jint length, void *userData) {
-    if (refKind == JVMTI_HEAP_REFERENCE_JNI_LOCAL || refKind == JVMTI_HEAP_REFERENCE_JNI_GLOBAL ||
-        isTagWithNewInfo(*tagPtr) || handleReferrersWithNoInfo(referrerTagPtr, tagPtr, true)) {
+    if (isTagWithNewInfo(*tagPtr) || handleReferrersWithNoInfo(referrerTagPtr, tagPtr, true)) {
         return JVMTI_VISIT_OBJECTS;
     }
 
@@ -59,8 +58,7 @@ jint JNICALL getTagsWithNewInfo(jvmtiHeapReferenceKind refKind, const jvmtiHeapR
 jint JNICALL visitReference(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
                             jlong referrerClassTag, jlong size, jlong *tagPtr,
                             jlong *referrerTagPtr, jint length, void *userData) {
-    if (refKind == JVMTI_HEAP_REFERENCE_JNI_LOCAL || refKind == JVMTI_HEAP_REFERENCE_JNI_GLOBAL ||
-        handleReferrersWithNoInfo(referrerTagPtr, tagPtr)) {
+    if (handleReferrersWithNoInfo(referrerTagPtr, tagPtr)) {
         return JVMTI_VISIT_OBJECTS;
     } else if (*tagPtr == 0) {
         *tagPtr = pointerToTag(tagToPointer(*referrerTagPtr)->share());
@@ -79,8 +77,13 @@ jint JNICALL visitReference(jvmtiHeapReferenceKind refKind, const jvmtiHeapRefer
 jint JNICALL spreadInfo(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
                         jlong referrerClassTag, jlong size, jlong *tagPtr,
                         jlong *referrerTagPtr, jint length, void *userData) {
-    if (refKind != JVMTI_HEAP_REFERENCE_JNI_LOCAL && refKind != JVMTI_HEAP_REFERENCE_JNI_GLOBAL &&
-        *tagPtr != 0 && *referrerTagPtr != 0) {
+    // This callback is passed to FollowReferences directly, so it applies the action's filter itself
+    auto *referenceFilter = reinterpret_cast<const ReferenceFilter *>(userData);
+    if (referenceFilter->isIgnored(refKind, refInfo)) {
+        return 0;
+    }
+
+    if (!referenceFilter->isHidden(refKind) && *tagPtr != 0 && *referrerTagPtr != 0) {
         auto it = tagsWithNewInfo.find(*tagPtr);
         if (it != tagsWithNewInfo.end()) {
             tagsWithNewInfo.erase(it);
@@ -126,7 +129,8 @@ jint JNICALL tagObjectOfTaggedClass(jlong classTag, jlong size, jlong *tagPtr, j
 
 jvmtiError walkHeapFromObjects(jvmtiEnv *jvmti,
                                const std::vector<jobject> &objects,
-                               const CancellationChecker &cancellationChecker) {
+                               const CancellationChecker &cancellationChecker,
+                               const ReferenceFilter &referenceFilter) {
     jvmtiError err = JVMTI_ERROR_NONE;
     if (!objects.empty()) {
         jvmtiHeapCallbacks cb;
@@ -144,7 +148,7 @@ jvmtiError walkHeapFromObjects(jvmtiEnv *jvmti,
 
             if (tagsWithNewInfo.find(tag) != tagsWithNewInfo.end()) {
                 tagsWithNewInfo.erase(tag);
-                err = jvmti->FollowReferences(0, nullptr, object, &cb, nullptr);
+                err = jvmti->FollowReferences(0, nullptr, object, &cb, &referenceFilter);
                 if (err != JVMTI_ERROR_NONE) return err;
                 logger::debug(std::to_string(tagsWithNewInfo.size()).c_str());
                 heapWalksCnt++;
@@ -30,13 +30,15 @@ jint JNICALL retagStartObjects      (jlong classTag, jlong size, jlong *tagPtr,
 
 jint JNICALL tagObjectOfTaggedClass (jlong classTag, jlong size, jlong *tagPtr, jint length, void *userData);
 
-jvmtiError walkHeapFromObjects      (jvmtiEnv *jvmti, const std::vector<jobject> &objects, const CancellationChecker &cancellationChecker);
+jvmtiError walkHeapFromObjects      (jvmtiEnv *jvmti, const std::vector<jobject> &objects, const CancellationChecker &cancellationChecker,
+                                     const ReferenceFilter &referenceFilter);
 
 template<typename RESULT_TYPE>
 class RetainedSizeAction : public MemoryAgentAction<RESULT_TYPE, jobjectArray> {
 protected:
     RetainedSizeAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction<RESULT_TYPE, jobjectArray>(env, jvmti, object) {
-
+        // Objects behind JNI references are still visited, but these references give them no retainer
+        this->referenceFilter.hide(ReferenceFilter::JNI_REFERENCES);
     }
 
     virtual RESULT_TYPE executeOperation(jobjectArray) = 0;
@@ -45,7 +47,7 @@ protected:
         jvmtiHeapCallbacks cb;
         std::memset(&cb, 0, sizeof(jvmtiHeapCallbacks));
         cb.heap_iteration_callback = clearTag;
-        jvmtiError err =  this->jvmti->IterateThroughHeap(0, nullptr, &cb, nullptr);
+        jvmtiError err =  this->jvmti->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, nullptr, &cb, nullptr);
 
         if (sizesTagBalance != 0) {
             logger::fatal("MEMORY LEAK FOUND!");
@@ -78,7 +80,7 @@ protected:
         jvmtiError err = createTagsForClasses(this->env, this->jvmti, classesArray);
         if (err != JVMTI_ERROR_NONE) return err;
 
-        return this->IterateThroughHeap(0, nullptr, tagObjectOfTaggedClass, nullptr);
+        return this->IterateThroughHeap(JVMTI_HEAP_FILTER_TAGGED | JVMTI_HEAP_FILTER_CLASS_UNTAGGED, nullptr, tagObjectOfTaggedClass, nullptr);
     }
 
     jvmtiError tagHeap() {
@@ -92,7 +94,7 @@ protected:
         if (err != JVMTI_ERROR_NONE) return err;
         if (this->shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
 
-        err = this->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, nullptr, retagStartObjects, nullptr, "retag start objects");
+        err = this->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED | JVMTI_HEAP_FILTER_CLASS_UNTAGGED, nullptr, retagStartObjects, nullptr, "retag start objects");
         if (err != JVMTI_ERROR_NONE) return err;
         if (this->shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
 
@@ -100,7 +102,7 @@ protected:
         if (err != JVMTI_ERROR_NONE) return err;
         if (this->shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
 
-        return walkHeapFromObjects(this->jvmti, objects, *dynamic_cast<CancellationChecker *>(this));
+        return walkHeapFromObjects(this->jvmti, objects, *dynamic_cast<CancellationChecker *>(this), this->referenceFilter);
     }
 };
 
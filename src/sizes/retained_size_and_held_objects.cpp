@@ -1,19 +1,17 @@
 // Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
 
+#include <algorithm>
+#include <memory>
 #include <vector>
 #include "retained_size_and_held_objects.h"
 #include "sizes_tags.h"
 
-#define START_TAG 1
-#define HELD_OBJECT_TAG 2
-#define VISITED_TAG 3
+#define PAGE_OBJECT_TAG 4
 
 jint JNICALL firstTraversal(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
                             jlong referrerClassTag, jlong size, jlong *tagPtr,
                             jlong *referrerTagPtr, jint length, void *userData) {
-    if (refKind == JVMTI_HEAP_REFERENCE_JNI_LOCAL || refKind == JVMTI_HEAP_REFERENCE_JNI_GLOBAL) {
-        return 0;
-    } else if (*tagPtr == START_TAG) {
+    if (*tagPtr == START_TAG) {
         return 0;
     } else if (*tagPtr == 0) {
         *tagPtr = VISITED_TAG;
@@ -25,7 +23,7 @@ jint JNICALL firstTraversal(jvmtiHeapReferenceKind refKind, const jvmtiHeapRefer
 jint JNICALL secondTraversal(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
                             jlong referrerClassTag, jlong size, jlong *tagPtr,
                             jlong *referrerTagPtr, jint length, void *userData) {
-    if (*tagPtr != 0 || refKind == JVMTI_HEAP_REFERENCE_JNI_LOCAL || refKind == JVMTI_HEAP_REFERENCE_JNI_GLOBAL) {
+    if (*tagPtr != 0) {
         return 0;
     } else if (*tagPtr == 0) {
         *reinterpret_cast<jlong *>(userData) += size;
@@ -35,44 +33,12 @@ jint JNICALL secondTraversal(jvmtiHeapReferenceKind refKind, const jvmtiHeapRefe
     return JVMTI_VISIT_OBJECTS;
 }
 
-RetainedSizeAndHeldObjectsAction::RetainedSizeAndHeldObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
-
-}
-
-jvmtiError RetainedSizeAndHeldObjectsAction::traverseHeapForTheFirstTime(jobject &object) {
-    jvmtiError err = jvmti->SetTag(object, START_TAG);
-    if (!isOk(err)) return err;
-    if (shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
+RetainedSizeAndHeldObjectsAction::RetainedSizeAndHeldObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : HeldObjectsAction(env, jvmti, object) {
 
-    progressManager.updateProgress(10, "Traversing heap for the first time...");
-    return FollowReferences(0, nullptr, nullptr, firstTraversal, nullptr, "tag heap");
-}
-
-jvmtiError RetainedSizeAndHeldObjectsAction::traverseHeapFromStartObjectAndCountRetainedSize(jobject &object, jlong &retainedSize) {
-    progressManager.updateProgress(80, "Traversing heap for the second time...");
-    retainedSize = 0;
-    jvmtiError err = FollowReferences(0, nullptr, object, secondTraversal, &retainedSize, "tag heap");
-    if (!isOk(err)) return err;
-    if (shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
-
-    err = jvmti->SetTag(object, HELD_OBJECT_TAG);
-    if (!isOk(err)) return err;
-
-    jlong startObjectSize = 0;
-    err = jvmti->GetObjectSize(object, &startObjectSize);
-    if (!isOk(err)) return err;
-
-    retainedSize += startObjectSize;
-
-    return JVMTI_ERROR_NONE;
 }
 
 jvmtiError RetainedSizeAndHeldObjectsAction::estimateObjectSize(jobject &object, jlong &retainedSize, std::vector<jobject> &heldObjects) {
-    jvmtiError err = traverseHeapForTheFirstTime(object);
-    if (!isOk(err)) return err;
-    if (shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
-
-    err = traverseHeapFromStartObjectAndCountRetainedSize(object, retainedSize);
+    jvmtiError err = tagHeldObjects(object, retainedSize);
     if (!isOk(err)) return err;
     if (shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
 
@@ -117,6 +83,229 @@ jobjectArray RetainedSizeAndHeldObjectsAction::executeOperation(jobject object)
     return createResultObject(retainedSize, shallowSize, heldObjects);
 }
 
-jvmtiError RetainedSizeAndHeldObjectsAction::cleanHeap() {
-    return removeAllTagsFromHeap(jvmti, nullptr);
+struct HeldObjectsHistogram {
+    explicit HeldObjectsHistogram(size_t classesCount) : counts(classesCount, 0), sizes(classesCount, 0) {}
+
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+};
+
+static jint JNICALL countHeldObject(jlong classTag, jlong size, jlong *tagPtr, jint length, void *userData) {
+    if (*tagPtr == HELD_OBJECT_TAG && classTag < 0) {
+        auto *histogram = reinterpret_cast<HeldObjectsHistogram *>(userData);
+        auto index = static_cast<size_t>(-classTag - 1);
+        histogram->counts[index]++;
+        histogram->sizes[index] += size;
+    }
+    return JVMTI_VISIT_OBJECTS;
+}
+
+static jint JNICALL tagHeldObjectOfClass(jlong classTag, jlong size, jlong *tagPtr, jint length, void *userData) {
+    if (*tagPtr == HELD_OBJECT_TAG) {
+        *tagPtr = PAGE_OBJECT_TAG;
+    }
+    return JVMTI_VISIT_OBJECTS;
+}
+
+namespace {
+    // Weak references to the held objects of the last query, next pages of it are read from here
+    struct HeldObjectsOfClassSnapshot {
+        HeldObjectsOfClassSnapshot(JNIEnv *env, jobject object, jobject classObject, const std::vector<jobject> &objects) :
+            object(env->NewWeakGlobalRef(object)), classObject(env->NewWeakGlobalRef(classObject)) {
+            env->GetJavaVM(&vm);
+            heldObjects.reserve(objects.size());
+            for (jobject heldObject : objects) {
+                heldObjects.push_back(env->NewWeakGlobalRef(heldObject));
+            }
+        }
+
+        ~HeldObjectsOfClassSnapshot() {
+            JNIEnv *env = nullptr;
+            if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK) {
+                return;
+            }
+            env->DeleteWeakGlobalRef(object);
+            env->DeleteWeakGlobalRef(classObject);
+            for (jweak heldObject : heldObjects) {
+                env->DeleteWeakGlobalRef(heldObject);
+            }
+        }
+
+        bool matches(JNIEnv *env, jobject otherObject, jobject otherClassObject) const {
+            return !env->IsSameObject(object, nullptr) && env->IsSameObject(object, otherObject) &&
+                   env->IsSameObject(classObject, otherClassObject);
+        }
+
+        JavaVM *vm = nullptr;
+        jweak object;
+        jweak classObject;
+        std::vector<jweak> heldObjects;
+    };
+
+    // Actions may run on any thread until the VM exits, so it is never destroyed
+    std::shared_ptr<HeldObjectsOfClassSnapshot> &lastHeldObjectsOfClass = *new std::shared_ptr<HeldObjectsOfClassSnapshot>();
+}
+
+HeldObjectsHistogramAction::HeldObjectsHistogramAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : HeldObjectsAction(env, jvmti, object) {
+
+}
+
+jobjectArray HeldObjectsHistogramAction::executeOperation(jobject object) {
+    jlong retainedSize;
+    jlong shallowSize;
+    jvmtiError err = tagHeldObjects(object, retainedSize);
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not estimate object size");
+        return nullptr;
+    }
+
+    err = jvmti->GetObjectSize(object, &shallowSize);
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not estimate object's shallow size");
+    }
+
+    jint classesCount;
+    jclass *classesPtr;
+    err = jvmti->GetLoadedClasses(&classesCount, &classesPtr);
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not get loaded classes");
+        return nullptr;
+    }
+    std::vector<jclass> classes(classesPtr, classesPtr + classesCount);
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(classesPtr));
+
+    // Class objects are retagged with their index, so held ones are counted before that
+    progressManager.updateProgress(85, "Counting held objects...");
+    HeldObjectsHistogram histogram(classes.size());
+    jlong heldClassesCount = 0;
+    jlong heldClassesSize = 0;
+    for (size_t i = 0; i < classes.size(); i++) {
+        jlong tag;
+        err = jvmti->GetTag(classes[i], &tag);
+        if (!isOk(err)) {
+            handleError(jvmti, err, "Could not get tag of class");
+            return nullptr;
+        }
+        if (tag == HELD_OBJECT_TAG) {
+            jlong size;
+            err = jvmti->GetObjectSize(classes[i], &size);
+            if (!isOk(err)) {
+                handleError(jvmti, err, "Could not estimate class's size");
+                return nullptr;
+            }
+            heldClassesCount++;
+            heldClassesSize += size;
+        }
+        err = jvmti->SetTag(classes[i], -static_cast<jlong>(i + 1));
+        if (!isOk(err)) {
+            handleError(jvmti, err, "Could not tag class");
+            return nullptr;
+        }
+    }
+
+    jclass classClass = env->FindClass("java/lang/Class");
+    jlong classClassTag;
+    err = jvmti->GetTag(classClass, &classClassTag);
+    env->DeleteLocalRef(classClass);
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not get tag of java.lang.Class");
+        return nullptr;
+    }
+    if (classClassTag < 0) {
+        histogram.counts[-classClassTag - 1] += heldClassesCount;
+        histogram.sizes[-classClassTag - 1] += heldClassesSize;
+    }
+
+    err = IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED | JVMTI_HEAP_FILTER_CLASS_UNTAGGED, nullptr,
+                             countHeldObject, &histogram, "count held objects");
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not count held objects");
+        return nullptr;
+    }
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i < classes.size(); i++) {
+        if (histogram.counts[i] > 0) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&histogram](size_t a, size_t b) {
+        return histogram.sizes[a] > histogram.sizes[b];
+    });
+
+    std::vector<jobject> resultClasses;
+    std::vector<jlong> counts;
+    std::vector<jlong> sizes;
+    for (size_t index : order) {
+        resultClasses.push_back(classes[index]);
+        counts.push_back(histogram.counts[index]);
+        sizes.push_back(histogram.sizes[index]);
+    }
+
+    std::vector<jlong> objectSizes{shallowSize, retainedSize};
+    jobjectArray result = env->NewObjectArray(4, env->FindClass("java/lang/Object"), nullptr);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, objectSizes));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, resultClasses));
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, counts));
+    env->SetObjectArrayElement(result, 3, toJavaArray(env, sizes));
+    return result;
+}
+
+HeldObjectsOfClassAction::HeldObjectsOfClassAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : HeldObjectsAction(env, jvmti, object) {
+
+}
+
+jobjectArray HeldObjectsOfClassAction::executeOperation(jobject object, jobject classObject, jint offset, jint limit) {
+    std::shared_ptr<HeldObjectsOfClassSnapshot> snapshot = std::atomic_load(&lastHeldObjectsOfClass);
+    if (offset <= 0 || !snapshot || !snapshot->matches(env, object, classObject)) {
+        std::vector<jobject> objects;
+        jvmtiError err = collectHeldObjectsOfClass(object, classObject, objects);
+        if (!isOk(err)) return nullptr;
+
+        snapshot = std::make_shared<HeldObjectsOfClassSnapshot>(env, object, classObject, objects);
+        std::atomic_store(&lastHeldObjectsOfClass, snapshot);
+    }
+
+    const std::vector<jweak> &heldObjects = snapshot->heldObjects;
+    size_t begin = std::min(static_cast<size_t>(std::max(offset, 0)), heldObjects.size());
+    size_t end = std::min(begin + static_cast<size_t>(std::max(limit, 0)), heldObjects.size());
+    std::vector<jobject> page;
+    for (size_t i = begin; i < end; i++) {
+        jobject heldObject = env->NewLocalRef(heldObjects[i]);
+        if (heldObject != nullptr) {
+            page.push_back(heldObject);
+        }
+    }
+
+    jobjectArray result = env->NewObjectArray(2, env->FindClass("java/lang/Object"), nullptr);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, page));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, static_cast<jint>(heldObjects.size())));
+    return result;
+}
+
+jvmtiError HeldObjectsOfClassAction::collectHeldObjectsOfClass(jobject object, jobject classObject, std::vector<jobject> &objects) {
+    isHeapTagged = true;
+    jlong retainedSize;
+    jvmtiError err = tagHeldObjects(object, retainedSize);
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not estimate object size");
+        return err;
+    }
+
+    progressManager.updateProgress(85, "Collecting held objects of class...");
+    err = IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, reinterpret_cast<jclass>(classObject),
+                             tagHeldObjectOfClass, nullptr, "collect held objects of class");
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not collect held objects of class");
+        return err;
+    }
+
+    err = getObjectsByTags(jvmti, std::vector<jlong>{PAGE_OBJECT_TAG}, objects);
+    handleError(jvmti, err, "Could not get held objects of class");
+    return err;
+}
+
+jvmtiError HeldObjectsOfClassAction::cleanHeap() {
+    // Pages read from the snapshot tag nothing
+    return isHeapTagged ? removeAllTagsFromHeap(jvmti, nullptr) : JVMTI_ERROR_NONE;
 }
@@ -5,21 +5,109 @@
 
 #include "../memory_agent_action.h"
 
-class RetainedSizeAndHeldObjectsAction : public MemoryAgentAction<jobjectArray, jobject> {
+#define START_TAG 1
+#define HELD_OBJECT_TAG 2
+#define VISITED_TAG 3
+
+jint JNICALL firstTraversal(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                            jlong referrerClassTag, jlong size, jlong *tagPtr,
+                            jlong *referrerTagPtr, jint length, void *userData);
+
+jint JNICALL secondTraversal(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
+                             jlong referrerClassTag, jlong size, jlong *tagPtr,
+                             jlong *referrerTagPtr, jint length, void *userData);
+
+template<typename RESULT_TYPE, typename... ARGS_TYPES>
+class HeldObjectsAction : public MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...> {
+protected:
+    HeldObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...>(env, jvmti, object) {
+        this->referenceFilter.ignore(ReferenceFilter::JNI_REFERENCES);
+    }
+
+    // Tags objects held by the given one, the object itself included, with HELD_OBJECT_TAG
+    jvmtiError tagHeldObjects(jobject &object, jlong &retainedSize) {
+        jvmtiError err = traverseHeapForTheFirstTime(object);
+        if (!isOk(err)) return err;
+        if (this->shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
+
+        return traverseHeapFromStartObjectAndCountRetainedSize(object, retainedSize);
+    }
+
+    jvmtiError cleanHeap() override {
+        return removeAllTagsFromHeap(this->jvmti, nullptr);
+    }
+
+private:
+    jvmtiError traverseHeapForTheFirstTime(jobject &object) {
+        jvmtiError err = this->jvmti->SetTag(object, START_TAG);
+        if (!isOk(err)) return err;
+        if (this->shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
+
+        this->progressManager.updateProgress(10, "Traversing heap for the first time...");
+        return this->FollowReferences(0, nullptr, nullptr, firstTraversal, nullptr, "tag heap");
+    }
+
+    jvmtiError traverseHeapFromStartObjectAndCountRetainedSize(jobject &object, jlong &retainedSize) {
+        this->progressManager.updateProgress(80, "Traversing heap for the second time...");
+        retainedSize = 0;
+        jvmtiError err = this->FollowReferences(0, nullptr, object, secondTraversal, &retainedSize, "tag heap");
+        if (!isOk(err)) return err;
+        if (this->shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
+
+        err = this->jvmti->SetTag(object, HELD_OBJECT_TAG);
+        if (!isOk(err)) return err;
+
+        jlong startObjectSize = 0;
+        err = this->jvmti->GetObjectSize(object, &startObjectSize);
+        if (!isOk(err)) return err;
+
+        retainedSize += startObjectSize;
+
+        return JVMTI_ERROR_NONE;
+    }
+};
+
+class RetainedSizeAndHeldObjectsAction : public HeldObjectsAction<jobjectArray, jobject> {
 public:
     RetainedSizeAndHeldObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
 
 private:
     jobjectArray executeOperation(jobject object) override;
-    jvmtiError cleanHeap() override;
 
     jvmtiError estimateObjectSize(jobject &object, jlong &retainedSize, std::vector<jobject> &heldObjects);
 
     jobjectArray createResultObject(jlong retainedSize, jlong shallowSize, const std::vector<jobject> &heldObjects);
+};
+
+/*
+ * Same as RetainedSizeAndHeldObjectsAction, but held objects are not returned:
+ * they are counted per class instead. Objects of a chosen class can be fetched
+ * page by page with HeldObjectsOfClassAction.
+ */
+class HeldObjectsHistogramAction : public HeldObjectsAction<jobjectArray, jobject> {
+public:
+    HeldObjectsHistogramAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobject object) override;
+};
+
+/*
+ * Returns a page of objects of the given class held by the given object. The first page traverses
+ * the heap and keeps weak references to all found objects, so next pages of the same object and class
+ * are taken from this snapshot without traversing the heap. Objects collected since then are skipped.
+ */
+class HeldObjectsOfClassAction : public HeldObjectsAction<jobjectArray, jobject, jobject, jint, jint> {
+public:
+    HeldObjectsOfClassAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobject object, jobject classObject, jint offset, jint limit) override;
+    jvmtiError cleanHeap() override;
 
-    jvmtiError traverseHeapForTheFirstTime(jobject &object);
+    jvmtiError collectHeldObjectsOfClass(jobject object, jobject classObject, std::vector<jobject> &objects);
 
-    jvmtiError traverseHeapFromStartObjectAndCountRetainedSize(jobject &object, jlong &retainedSize);
+    bool isHeapTagged = false;
 };
 
 #endif //MEMORY_AGENT_RETAINED_SIZE_AND_HELD_OBJECTS_H
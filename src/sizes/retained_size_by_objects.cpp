@@ -5,7 +5,7 @@
 #include "retained_size_by_classes.h"
 
 RetainedSizeByObjectsAction::RetainedSizeByObjectsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
-
+    referenceFilter.hide(ReferenceFilter::JNI_REFERENCES);
 }
 
 jvmtiError RetainedSizeByObjectsAction::calculateRetainedSizes(const std::vector<jobject> &objects, std::vector<jlong> &result) {
@@ -85,7 +85,7 @@ jvmtiError RetainedSizeByObjectsAction::tagHeap(const std::vector<jobject> &obje
     if (!isOk(err)) return err;
     if (shouldStopExecution()) return MEMORY_AGENT_INTERRUPTED_ERROR;
 
-    return walkHeapFromObjects(jvmti, taggedObjects, *dynamic_cast<CancellationChecker *>(this));
+    return walkHeapFromObjects(jvmti, taggedObjects, *dynamic_cast<CancellationChecker *>(this), referenceFilter);
 }
 
 jvmtiError RetainedSizeByObjectsAction::estimateObjectsSizes(const std::vector<jobject> &objects, std::vector<jlong> &result) {
@@ -117,7 +117,7 @@ jvmtiError RetainedSizeByObjectsAction::cleanHeap() {
     jvmtiHeapCallbacks cb;
     std::memset(&cb, 0, sizeof(jvmtiHeapCallbacks));
     cb.heap_iteration_callback = clearTag;
-    jvmtiError err =  this->jvmti->IterateThroughHeap(0, nullptr, &cb, nullptr);
+    jvmtiError err =  this->jvmti->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, nullptr, &cb, nullptr);
 
     if (sizesTagBalance != 0) {
         logger::fatal("MEMORY LEAK FOUND!");
@@ -0,0 +1,177 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#include "retained_size_by_threads.h"
+#include "dominator_tree.h"
+#include "../heap_graph.h"
+#include "../roots/infos.h"
+
+/*
+ * Heap graph where stack local references are attached to the virtual root through
+ * a vertex per thread, per stack frame and per local variable slot. Retained sizes
+ * of these vertices are the sizes retained by the corresponding stack parts.
+ */
+class ThreadStacksHeapGraph : public HeapGraph {
+public:
+    struct FrameVertices {
+        jlong vertex;
+        jmethodID method;
+        std::map<jint, jlong> slots;
+    };
+
+    struct ThreadVertices {
+        jlong vertex;
+        jlong threadTag;
+        std::map<jint, FrameVertices> frames;
+    };
+
+protected:
+    jlong getRootVertex(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo) override {
+        if (refKind != JVMTI_HEAP_REFERENCE_STACK_LOCAL) {
+            return 0;
+        }
+
+        const jvmtiHeapReferenceInfoStackLocal &stackLocal = refInfo->stack_local;
+        auto threadIt = threads.find(stackLocal.thread_id);
+        if (threadIt == threads.end()) {
+            jlong vertex = addVertex(0);
+            addEdge(0, vertex);
+            threadIt = threads.emplace(stackLocal.thread_id, ThreadVertices{vertex, stackLocal.thread_tag, {}}).first;
+        }
+        ThreadVertices &thread = threadIt->second;
+
+        auto frameIt = thread.frames.find(stackLocal.depth);
+        if (frameIt == thread.frames.end()) {
+            jlong vertex = addVertex(0);
+            addEdge(thread.vertex, vertex);
+            frameIt = thread.frames.emplace(stackLocal.depth, FrameVertices{vertex, stackLocal.method, {}}).first;
+        }
+        FrameVertices &frame = frameIt->second;
+
+        auto slotIt = frame.slots.find(stackLocal.slot);
+        if (slotIt == frame.slots.end()) {
+            jlong vertex = addVertex(0);
+            addEdge(frame.vertex, vertex);
+            slotIt = frame.slots.emplace(stackLocal.slot, vertex).first;
+        }
+        return slotIt->second;
+    }
+
+public:
+    std::map<jlong, ThreadVertices> threads;
+};
+
+namespace {
+    jobjectArray getObjectArrayOfSize(JNIEnv *env, size_t size) {
+        return env->NewObjectArray(static_cast<jsize>(size), env->FindClass("java/lang/Object"), nullptr);
+    }
+
+    jobjectArray createFramesInfo(JNIEnv *env, MethodInfoCache &methodInfos, const ThreadStacksHeapGraph::ThreadVertices &thread,
+                                  const std::vector<jlong> &retainedSizes) {
+        std::vector<jint> depths;
+        std::vector<jlong> frameSizes;
+        jobjectArray methods = getObjectArrayOfSize(env, thread.frames.size());
+        jobjectArray locals = getObjectArrayOfSize(env, thread.frames.size());
+        jsize i = 0;
+        for (auto &frameEntry : thread.frames) {
+            const ThreadStacksHeapGraph::FrameVertices &frame = frameEntry.second;
+            depths.push_back(frameEntry.first);
+            frameSizes.push_back(retainedSizes[frame.vertex]);
+            env->SetObjectArrayElement(methods, i, methodInfos.getMethodInfo(methodInfos.getIndex(frame.method)));
+
+            std::vector<jint> slots;
+            std::vector<jlong> slotSizes;
+            for (auto &slotEntry : frame.slots) {
+                slots.push_back(slotEntry.first);
+                slotSizes.push_back(retainedSizes[slotEntry.second]);
+            }
+            env->SetObjectArrayElement(locals, i, wrapWithArray(env, toJavaArray(env, slots), toJavaArray(env, slotSizes)));
+            i++;
+        }
+
+        jobjectArray result = getObjectArrayOfSize(env, 4);
+        env->SetObjectArrayElement(result, 0, toJavaArray(env, depths));
+        env->SetObjectArrayElement(result, 1, methods);
+        env->SetObjectArrayElement(result, 2, toJavaArray(env, frameSizes));
+        env->SetObjectArrayElement(result, 3, locals);
+        return result;
+    }
+}
+
+RetainedSizesByThreadsAction::RetainedSizesByThreadsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) :
+    MemoryAgentAction(env, jvmti, object) {
+    referenceFilter.ignore(ReferenceFilter::JNI_REFERENCES);
+}
+
+jobjectArray RetainedSizesByThreadsAction::executeOperation() {
+    ThreadStacksHeapGraph heapGraph;
+    progressManager.updateProgress(10, "Traversing heap...");
+    logger::resetTimer();
+    jvmtiError err = FollowReferences(0, nullptr, nullptr, HeapGraph::captureReference, &heapGraph);
+    logger::logPassedTime();
+    if (!isOk(err) || shouldStopExecution()) return nullptr;
+
+    progressManager.updateProgress(70, "Calculating retained sizes...");
+    std::vector<jlong> retainedSizes = calculateRetainedSizesViaDominatorTree(heapGraph.graph, heapGraph.sizes);
+    if (shouldStopExecution()) return nullptr;
+
+    progressManager.updateProgress(95, "Extracting answer...");
+    return constructResultObject(heapGraph, retainedSizes);
+}
+
+jobjectArray RetainedSizesByThreadsAction::constructResultObject(const ThreadStacksHeapGraph &heapGraph,
+                                                                 const std::vector<jlong> &retainedSizes) {
+    std::vector<std::pair<jlong, const ThreadStacksHeapGraph::ThreadVertices *>> threads;
+    std::vector<jlong> threadTags;
+    for (auto &entry : heapGraph.threads) {
+        threads.emplace_back(entry.first, &entry.second);
+        if (entry.second.threadTag != 0) {
+            threadTags.push_back(entry.second.threadTag);
+        }
+    }
+
+    // Sort threads by the size retained by their stacks
+    std::stable_sort(threads.begin(), threads.end(), [&](const auto &a, const auto &b) {
+        return retainedSizes[a.second->vertex] > retainedSizes[b.second->vertex];
+    });
+
+    std::vector<std::pair<jobject, jlong>> threadObjects;
+    jvmtiError err = getObjectsByTags(jvmti, threadTags, threadObjects);
+    if (!isOk(err)) return nullptr;
+
+    std::unordered_map<jlong, jobject> tagToThread;
+    for (auto &threadObject : threadObjects) {
+        tagToThread[threadObject.second] = threadObject.first;
+    }
+
+    auto threadsCount = static_cast<jsize>(threads.size());
+    jobjectArray threadsArray = getObjectArrayOfSize(env, threadsCount);
+    jobjectArray framesArray = getObjectArrayOfSize(env, threadsCount);
+    std::vector<jlong> threadIds;
+    std::vector<jlong> threadSizes;
+    MethodInfoCache methodInfos(env, jvmti);
+    for (jsize i = 0; i < threadsCount; i++) {
+        const ThreadStacksHeapGraph::ThreadVertices &thread = *threads[i].second;
+        auto it = tagToThread.find(thread.threadTag);
+        if (it != tagToThread.end()) {
+            env->SetObjectArrayElement(threadsArray, i, it->second);
+        }
+        threadIds.push_back(threads[i].first);
+        threadSizes.push_back(retainedSizes[thread.vertex]);
+        env->SetObjectArrayElement(framesArray, i, createFramesInfo(env, methodInfos, thread, retainedSizes));
+    }
+
+    jobjectArray result = getObjectArrayOfSize(env, 4);
+    env->SetObjectArrayElement(result, 0, threadsArray);
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, threadIds));
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, threadSizes));
+    env->SetObjectArrayElement(result, 3, framesArray);
+    return result;
+}
+
+jvmtiError RetainedSizesByThreadsAction::cleanHeap() {
+    return removeAllTagsFromHeap(jvmti, nullptr);
+}
@@ -0,0 +1,24 @@
+// Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
+
+#ifndef MEMORY_AGENT_RETAINED_SIZE_BY_THREADS_H
+#define MEMORY_AGENT_RETAINED_SIZE_BY_THREADS_H
+
+#include <vector>
+#include <jvmti.h>
+#include "../memory_agent_action.h"
+
+// Forward declaration
+class ThreadStacksHeapGraph;
+
+class RetainedSizesByThreadsAction : public MemoryAgentAction<jobjectArray> {
+public:
+    RetainedSizesByThreadsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation() override;
+    jvmtiError cleanHeap() override;
+
+    jobjectArray constructResultObject(const ThreadStacksHeapGraph &heapGraph, const std::vector<jlong> &retainedSizes);
+};
+
+#endif //MEMORY_AGENT_RETAINED_SIZE_BY_THREADS_H
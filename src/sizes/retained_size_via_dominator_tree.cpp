@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <algorithm>
+#include <unordered_map>
 
 #include "retained_size_via_dominator_tree.h"
 #include "dominator_tree.h"
@@ -83,9 +84,7 @@ namespace {
     jint JNICALL collectObjects(jvmtiHeapReferenceKind refKind, const jvmtiHeapReferenceInfo *refInfo, jlong classTag,
                                 jlong referrerClassTag, jlong size, jlong *tagPtr,
                                 jlong *referrerTagPtr, jint length, void *userData) {
-        if (refKind == JVMTI_HEAP_REFERENCE_JNI_LOCAL || refKind == JVMTI_HEAP_REFERENCE_JNI_GLOBAL) {
-            return 0;
-        } else if (classTag == CLASS_TAG) {
+        if (classTag == CLASS_TAG) {
             *tagPtr = OBJECT_OF_CLASS_TAG;
         }
         return JVMTI_VISIT_OBJECTS;
@@ -95,9 +94,7 @@ namespace {
                                 jlong referrerClassTag, jlong size, jlong *tagPtr,
                                 jlong *referrerTagPtr, jint length, void *userData) {
         auto *info = reinterpret_cast<SizesViaDominatorTreeHeapDumpInfo *>(userData);
-        if (refKind == JVMTI_HEAP_REFERENCE_JNI_LOCAL || refKind == JVMTI_HEAP_REFERENCE_JNI_GLOBAL) {
-            return 0;
-        } else if (*tagPtr == 0) {
+        if (*tagPtr == 0) {
             *tagPtr = VISITED_TAG;
         } else if (*tagPtr <= info->lastStartTag) {
             if (*tagPtr > 0) {
@@ -117,7 +114,7 @@ namespace {
         }
 
         auto *info = reinterpret_cast<SizesViaDominatorTreeHeapDumpInfo *>(userData);
-        if (*tagPtr == VISITED_TAG || refKind == JVMTI_HEAP_REFERENCE_JNI_LOCAL || refKind == JVMTI_HEAP_REFERENCE_JNI_GLOBAL) {
+        if (*tagPtr == VISITED_TAG) {
             return 0;
         } else if (*tagPtr == 0) {
             *tagPtr = info->addNewVertex(size);
@@ -136,9 +133,8 @@ namespace {
 }
 
 template<typename RESULT_TYPE, typename... ARGS_TYPES>
-jvmtiError RetainedSizesAction<RESULT_TYPE, ARGS_TYPES...>::calculateRetainedSizes(jobjectArray objects,
-                                                                                   std::vector<jlong> &retainedSizes,
-                                                                                   SizesViaDominatorTreeHeapDumpInfo &info) {
+jvmtiError RetainedSizesAction<RESULT_TYPE, ARGS_TYPES...>::captureHeldObjectsGraph(jobjectArray objects,
+                                                                                    SizesViaDominatorTreeHeapDumpInfo &info) {
     jvmtiError err = info.initAndSetTagsForObjects(this->env, this->jvmti, objects);
     if (!isOk(err)) return err;
 
@@ -156,11 +152,20 @@ jvmtiError RetainedSizesAction<RESULT_TYPE, ARGS_TYPES...>::calculateRetainedSiz
     this->progressManager.updateProgress(60, "Traversing heap for the second time...");
     err = this->FollowReferences(0, nullptr, objects, secondTraversal, &info);
     logger::logPassedTime();
+    return err;
+}
+
+template<typename RESULT_TYPE, typename... ARGS_TYPES>
+jvmtiError RetainedSizesAction<RESULT_TYPE, ARGS_TYPES...>::calculateRetainedSizes(jobjectArray objects,
+                                                                                   std::vector<jlong> &retainedSizes,
+                                                                                   SizesViaDominatorTreeHeapDumpInfo &info,
+                                                                                   std::vector<jlong> *dominators) {
+    jvmtiError err = captureHeldObjectsGraph(objects, info);
     if (!isOk(err) || this->shouldStopExecution()) return err;
 
     this->progressManager.updateProgress(80, "Calculating retained size...");
     info.setUpNeighboursForMasterNode();
-    retainedSizes = calculateRetainedSizesViaDominatorTree(info.graph, info.sizes);
+    retainedSizes = calculateRetainedSizesViaDominatorTree(info.graph, info.sizes, dominators);
 
     return err;
 }
@@ -168,7 +173,7 @@ jvmtiError RetainedSizesAction<RESULT_TYPE, ARGS_TYPES...>::calculateRetainedSiz
 template<typename RESULT_TYPE, typename... ARGS_TYPES>
 RetainedSizesAction<RESULT_TYPE, ARGS_TYPES...>::RetainedSizesAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) :
     MemoryAgentAction<RESULT_TYPE, ARGS_TYPES...>(env, jvmti, object) {
-
+    this->referenceFilter.ignore(ReferenceFilter::JNI_REFERENCES);
 }
 
 jobjectArray RetainedSizesViaDominatorTreeAction::executeOperation(jobjectArray objects) {
@@ -286,3 +291,169 @@ jvmtiError RetainedSizesByClassViaDominatorTreeAction::cleanHeap() {
 RetainedSizesByClassViaDominatorTreeAction::RetainedSizesByClassViaDominatorTreeAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) :
     RetainedSizesAction(env, jvmti, object) {
 }
+
+RetainedSizesAndHeldObjectsViaDominatorTreeAction::RetainedSizesAndHeldObjectsViaDominatorTreeAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) :
+    RetainedSizesAction(env, jvmti, object) {
+}
+
+jvmtiError RetainedSizesAndHeldObjectsViaDominatorTreeAction::collectHeldObjects(const SizesViaDominatorTreeHeapDumpInfo &info,
+                                                                                const std::vector<jlong> &dominators,
+                                                                                std::vector<std::vector<jobject>> &heldObjects) {
+    // owner is the closest start vertex among the vertex itself and its dominators, -1 if there is none
+    auto verticesCount = static_cast<jlong>(info.graph.size());
+    std::vector<jlong> owner(info.graph.size(), -2);
+    std::vector<jlong> path;
+    owner[0] = -1;
+    for (jlong v = 1; v < verticesCount; v++) {
+        jlong u = v;
+        while (owner[u] == -2 && u > info.lastStartTag && dominators[u] >= 0) {
+            path.push_back(u);
+            u = dominators[u];
+        }
+        if (owner[u] == -2) {
+            owner[u] = u <= info.lastStartTag ? u : -1;
+        }
+        for (jlong w : path) {
+            owner[w] = owner[u];
+        }
+        path.clear();
+    }
+
+    std::vector<jlong> tags;
+    for (jlong v = 1; v < verticesCount; v++) {
+        if (owner[v] != -1) {
+            tags.push_back(v);
+        }
+    }
+
+    std::vector<std::pair<jobject, jlong>> objectsAndTags;
+    jvmtiError err = getObjectsByTags(jvmti, tags, objectsAndTags);
+    if (!isOk(err)) return err;
+
+    heldObjects.resize(info.lastStartTag + 1);
+    for (auto &objectAndTag : objectsAndTags) {
+        // start vertices dominated by other start vertices are held by all of them
+        for (jlong start = owner[objectAndTag.second]; start != -1; start = owner[dominators[start]]) {
+            heldObjects[start].push_back(objectAndTag.first);
+            if (dominators[start] < 0) break;
+        }
+    }
+    return err;
+}
+
+jobjectArray RetainedSizesAndHeldObjectsViaDominatorTreeAction::executeOperation(jobjectArray objects) {
+    SizesViaDominatorTreeHeapDumpInfo info;
+    std::vector<jlong> retainedSizes;
+    std::vector<jlong> dominators;
+    jvmtiError err = calculateRetainedSizes(objects, retainedSizes, info, &dominators);
+    if (!isOk(err) || shouldStopExecution()) return nullptr;
+
+    progressManager.updateProgress(85, "Collecting held objects...");
+    std::vector<std::vector<jobject>> heldObjects;
+    err = collectHeldObjects(info, dominators, heldObjects);
+    if (!isOk(err) || shouldStopExecution()) return nullptr;
+
+    progressManager.updateProgress(95, "Extracting answer...");
+    jsize size = env->GetArrayLength(objects);
+    std::vector<jlong> shallowSizes;
+    std::vector<jlong> resultingRetainedSizes;
+    jobjectArray resultingHeldObjects = getObjectArrayOfSize(env, size);
+    for (jsize i = 0; i < size; i++) {
+        jobject object = env->GetObjectArrayElement(objects, i);
+        jlong tag;
+        jvmti->GetTag(object, &tag);
+        resultingRetainedSizes.push_back(retainedSizes[tag]);
+        shallowSizes.push_back(info.sizes[tag]);
+        env->SetObjectArrayElement(resultingHeldObjects, i, toJavaArray(env, heldObjects[tag]));
+    }
+
+    jobjectArray result = getObjectArrayOfSize(env, 3);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, shallowSizes));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, resultingRetainedSizes));
+    env->SetObjectArrayElement(result, 2, resultingHeldObjects);
+
+    return result;
+}
+
+jvmtiError RetainedSizesAndHeldObjectsViaDominatorTreeAction::cleanHeap() {
+    return removeAllTagsFromHeap(jvmti, nullptr);
+}
+
+RetainedSizesByGroupsAction::RetainedSizesByGroupsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) :
+    RetainedSizesAction(env, jvmti, object) {
+}
+
+jobjectArray RetainedSizesByGroupsAction::executeOperation(jobjectArray objects, jintArray groupIds) {
+    jsize size = env->GetArrayLength(objects);
+    if (env->GetArrayLength(groupIds) != size) {
+        logger::error("objects and group ids differ in length");
+        return nullptr;
+    }
+
+    SizesViaDominatorTreeHeapDumpInfo info;
+    jvmtiError err = captureHeldObjectsGraph(objects, info);
+    if (!isOk(err) || shouldStopExecution()) return nullptr;
+
+    progressManager.updateProgress(80, "Calculating retained size...");
+    std::vector<jint> ids(static_cast<size_t>(size));
+    env->GetIntArrayRegion(groupIds, 0, size, ids.data());
+
+    // Group vertices are created after all held objects, so they are stored by group ordinals
+    std::unordered_map<jint, size_t> groupToIndex;
+    std::vector<jint> groups;
+    std::vector<jlong> groupVertices;
+    std::vector<jlong> shallowSizes;
+    std::vector<jlong> memberToGroupVertex(info.lastStartTag + 1, -1);
+    for (jsize i = 0; i < size; i++) {
+        jlong tag;
+        jvmti->GetTag(env->GetObjectArrayElement(objects, i), &tag);
+        if (tag <= 0 || tag > info.lastStartTag || memberToGroupVertex[tag] != -1) continue;
+
+        auto it = groupToIndex.find(ids[i]);
+        if (it == groupToIndex.end()) {
+            it = groupToIndex.emplace(ids[i], groups.size()).first;
+            groups.push_back(ids[i]);
+            groupVertices.push_back(info.addNewVertex(0));
+            shallowSizes.push_back(0);
+        }
+        memberToGroupVertex[tag] = groupVertices[it->second];
+        shallowSizes[it->second] += info.sizes[tag];
+    }
+
+    // References to members go to their group vertices, while group vertices refer to the members
+    for (auto &neighbours : info.graph) {
+        for (jlong &neighbour : neighbours) {
+            if (neighbour <= info.lastStartTag && memberToGroupVertex[neighbour] != -1) {
+                neighbour = memberToGroupVertex[neighbour];
+            }
+        }
+    }
+    for (jlong member = 1; member <= info.lastStartTag; member++) {
+        jlong groupVertex = memberToGroupVertex[member];
+        if (groupVertex == -1) continue;
+
+        info.addNeighbour(groupVertex, member);
+        if (info.wasVisitedDuringFirstTraversal[member]) {
+            info.addNeighbour(0, groupVertex);
+        }
+    }
+
+    std::vector<jlong> retainedSizes = calculateRetainedSizesViaDominatorTree(info.graph, info.sizes);
+    std::vector<jlong> groupRetainedSizes;
+    groupRetainedSizes.reserve(groupVertices.size());
+    for (jlong groupVertex : groupVertices) {
+        groupRetainedSizes.push_back(retainedSizes[groupVertex]);
+    }
+
+    progressManager.updateProgress(95, "Extracting answer...");
+    jobjectArray result = getObjectArrayOfSize(env, 3);
+    env->SetObjectArrayElement(result, 0, toJavaArray(env, groups));
+    env->SetObjectArrayElement(result, 1, toJavaArray(env, shallowSizes));
+    env->SetObjectArrayElement(result, 2, toJavaArray(env, groupRetainedSizes));
+
+    return result;
+}
+
+jvmtiError RetainedSizesByGroupsAction::cleanHeap() {
+    return removeAllTagsFromHeap(jvmti, nullptr);
+}
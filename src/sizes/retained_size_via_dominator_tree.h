@@ -16,8 +16,11 @@ public:
     RetainedSizesAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
 
 protected:
+    // Captures the graph of objects that are only reachable from the heap roots through the given ones
+    jvmtiError captureHeldObjectsGraph(jobjectArray objects, SizesViaDominatorTreeHeapDumpInfo &info);
+
     jvmtiError calculateRetainedSizes(jobjectArray objects, std::vector<jlong> &retainedSizes,
-                                      SizesViaDominatorTreeHeapDumpInfo &info);
+                                      SizesViaDominatorTreeHeapDumpInfo &info, std::vector<jlong> *dominators=nullptr);
 };
 
 class RetainedSizesViaDominatorTreeAction : public RetainedSizesAction<jobjectArray, jobjectArray> {
@@ -44,4 +47,36 @@ private:
                                        const SizesViaDominatorTreeHeapDumpInfo &info, jlong objectsLimit);
 };
 
+/*
+ * Retained sizes and held objects of several objects at once. The heap is traversed
+ * twice regardless of the number of objects, held objects are the dominator subtrees.
+ */
+class RetainedSizesAndHeldObjectsViaDominatorTreeAction : public RetainedSizesAction<jobjectArray, jobjectArray> {
+public:
+    RetainedSizesAndHeldObjectsViaDominatorTreeAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobjectArray objects) override;
+    jvmtiError cleanHeap() override;
+
+    jvmtiError collectHeldObjects(const SizesViaDominatorTreeHeapDumpInfo &info, const std::vector<jlong> &dominators,
+                                  std::vector<std::vector<jobject>> &heldObjects);
+};
+
+/*
+ * Memory retained by groups of objects as a whole. Members of a group are attached to a virtual
+ * group vertex that takes over all references to them, and all groups share one dominator tree.
+ * So retained sets of different groups never overlap: an object that is freed only when two groups
+ * are removed together is not counted for either of them. Objects belong to the group of their
+ * first occurrence.
+ */
+class RetainedSizesByGroupsAction : public RetainedSizesAction<jobjectArray, jobjectArray, jintArray> {
+public:
+    RetainedSizesByGroupsAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object);
+
+private:
+    jobjectArray executeOperation(jobjectArray objects, jintArray groupIds) override;
+    jvmtiError cleanHeap() override;
+};
+
 #endif //MEMORY_AGENT_RETAINED_SIZE_VIA_DOMINATOR_TREE_ACTION_H
@@ -1,9 +1,11 @@
 // Copyright 2000-2018 JetBrains s.r.o. Use of this source code is governed by the Apache 2.0 license that can be found in the LICENSE file.
 
 #include <memory>
+#include <vector>
 #include "shallow_size_by_classes.h"
 #include "sizes_tags.h"
 #include "retained_size_action.h"
+#include "../class_index.h"
 
 static jint JNICALL calculateShallowSize(jlong classTag, jlong size, jlong *tagPtr, jint length, void *userData) {
     ClassTag *pClassTag = tagToClassTagPointer(classTag);
@@ -15,6 +17,11 @@ static jint JNICALL calculateShallowSize(jlong classTag, jlong size, jlong *tagP
     return JVMTI_VISIT_OBJECTS;
 }
 
+static jint JNICALL addShallowSize(jlong classTag, jlong size, jlong *tagPtr, jint length, void *userData) {
+    *reinterpret_cast<jlong *>(userData) += size;
+    return JVMTI_VISIT_OBJECTS;
+}
+
 ShallowSizeByClassesAction::ShallowSizeByClassesAction(JNIEnv *env, jvmtiEnv *jvmti, jobject object) : MemoryAgentAction(env, jvmti, object) {
 
 }
@@ -36,17 +43,46 @@ void ShallowSizeByClassesAction::tagClasses(jobjectArray classesArray) {
     }
 }
 
+jclass ShallowSizeByClassesAction::getSingleClassWithoutSubtypes(jobjectArray classesArray) {
+    if (env->GetArrayLength(classesArray) != 1) return nullptr;
+
+    auto classObject = reinterpret_cast<jclass>(env->GetObjectArrayElement(classesArray, 0));
+    size_t subtypesCount = 0;
+    jvmtiError err = classIndex.forEachSubtype(env, classObject, [&subtypesCount](jclass klass) {
+        subtypesCount++;
+        return JVMTI_ERROR_NONE;
+    });
+    return isOk(err) && subtypesCount == 1 ? classObject : nullptr;
+}
+
 jlongArray ShallowSizeByClassesAction::executeOperation(jobjectArray classesArray) {
     jsize classesCount = env->GetArrayLength(classesArray);
     jlongArray result = env->NewLongArray(classesCount);
-    auto sizes = new jlong[classesCount];
-    std::memset(sizes, 0, sizeof(jlong) * classesCount);
+
+    // JVMTI filters objects of a single class itself, so neither tags nor a callback per heap object are needed
+    jclass singleClass = getSingleClassWithoutSubtypes(classesArray);
+    if (singleClass != nullptr) {
+        jlong size = 0;
+        jvmtiError err = IterateThroughHeap(0, singleClass, addShallowSize, &size);
+        if (!isOk(err)) {
+            handleError(jvmti, err, "Could not calculate shallow size of class");
+            return nullptr;
+        }
+        env->SetLongArrayRegion(result, 0, 1, &size);
+        return result;
+    }
+
+    std::vector<jlong> sizes(static_cast<size_t>(classesCount), 0);
     tagClasses(classesArray);
 
     if (shouldStopExecution()) return env->NewLongArray(0);
 
-    IterateThroughHeap(JVMTI_HEAP_FILTER_CLASS_UNTAGGED, nullptr, calculateShallowSize, sizes);
-    env->SetLongArrayRegion(result, 0, classesCount, sizes);
+    jvmtiError err = IterateThroughHeap(JVMTI_HEAP_FILTER_CLASS_UNTAGGED, nullptr, calculateShallowSize, sizes.data());
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Could not calculate shallow sizes of classes");
+        return nullptr;
+    }
+    env->SetLongArrayRegion(result, 0, classesCount, sizes.data());
     return result;
 }
 
@@ -54,7 +90,7 @@ jvmtiError ShallowSizeByClassesAction::cleanHeap() {
     jvmtiHeapCallbacks cb;
     std::memset(&cb, 0, sizeof(jvmtiHeapCallbacks));
     cb.heap_iteration_callback = clearTag;
-    jvmtiError err =  this->jvmti->IterateThroughHeap(0, nullptr, &cb, nullptr);
+    jvmtiError err =  this->jvmti->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, nullptr, &cb, nullptr);
 
     if (sizesTagBalance != 0) {
         logger::fatal("MEMORY LEAK FOUND!");
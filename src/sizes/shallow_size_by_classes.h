@@ -14,6 +14,8 @@ private:
     jvmtiError cleanHeap() override;
 
     void tagClasses(jobjectArray classesArray);
+
+    jclass getSingleClassWithoutSubtypes(jobjectArray classesArray);
 };
 
 
@@ -7,6 +7,7 @@
 #include "utils.h"
 #include "memory_agent_action.h"
 #include "log.h"
+#include "class_index.h"
 
 const char *getReferenceTypeDescription(jvmtiHeapReferenceKind kind) {
     if (kind == JVMTI_HEAP_REFERENCE_CLASS) return "Reference from an object to its class.";
@@ -232,55 +233,17 @@ std::string jstringTostring(JNIEnv *env, jstring jStr) {
 }
 
 jvmtiError tagClassAndItsInheritors(JNIEnv *env, jvmtiEnv *jvmti, jobject classObject, std::function<jlong (jlong)> &&createTag) {
-    jclass *classes;
-    jint cnt;
-    jvmtiError err = jvmti->GetLoadedClasses(&cnt, &classes);
-    if (err != JVMTI_ERROR_NONE) return err;
-
-    jclass langClass = env->FindClass("java/lang/Class");
-    jmethodID isAssignableFrom = env->GetMethodID(langClass, "isAssignableFrom", "(Ljava/lang/Class;)Z");
-
-    for (int i = 0; i < cnt; i++) {
-        if (env->CallBooleanMethod(classObject, isAssignableFrom, classes[i])) {
-            jlong oldTag;
-            err = jvmti->GetTag(classes[i], &oldTag);
-            if (err != JVMTI_ERROR_NONE) return err;
-
-            char* sig;
-            if (jvmti->GetClassSignature(classes[i], &sig, nullptr) != JVMTI_ERROR_NONE) {
-                continue;
-            }
-
-            // jdk/internal/vm/FillerArray objects are used to mark dead heap areas
-            // see https://bugs.openjdk.org/browse/JDK-8284435
-            // These objects must not be accessible, so they are facultative for analysis.
-            //
-            // However, these objects are invisible for consecutive jvmti->IterateThroughHeap calls.
-            //
-            // Simple test: tag all objects with IterateThroughHeap, then remove tags with another IterateThroughHeap
-            // call. There will be 3 tags left.
-            //
-            // see https://youtrack.jetbrains.com/issue/IDEA-330128
-            if (strcmp(sig, "Ljdk/internal/vm/FillerArray;") == 0
-                || strcmp(sig, "Ljdk/internal/vm/FillerObject;") == 0
-                || strcmp(sig, "[Ljdk/internal/vm/FillerElement;") == 0) {
-                continue;
-            }
-
-            jlong newTag = createTag(oldTag);
-            if (newTag != 0)  {
-                err = jvmti->SetTag(classes[i], newTag);
-                if (err != JVMTI_ERROR_NONE) return err;
-            }
+    return classIndex.forEachSubtype(env, reinterpret_cast<jclass>(classObject), [&](jclass klass) {
+        jlong oldTag;
+        jvmtiError err = jvmti->GetTag(klass, &oldTag);
+        if (err != JVMTI_ERROR_NONE) return err;
+
+        jlong newTag = createTag(oldTag);
+        if (newTag != 0) {
+            err = jvmti->SetTag(klass, newTag);
         }
-    }
-
-    return err;
-}
-
-jmethodID getIsAssignableFromMethod(JNIEnv *env) {
-    jclass langClass = env->FindClass("java/lang/Class");
-    return env->GetMethodID(langClass, "isAssignableFrom", "(Ljava/lang/Class;)Z");
+        return err;
+    });
 }
 
 std::string getToString(JNIEnv *env, jobject object) {
@@ -288,51 +251,69 @@ std::string getToString(JNIEnv *env, jobject object) {
     return jstringTostring(env, reinterpret_cast<jstring>(name));
 }
 
-ThreadSuspender::ThreadSuspender(jvmtiEnv *jvmti) : jvmti(jvmti) {
+ThreadSuspender::ThreadSuspender(JNIEnv *env, jvmtiEnv *jvmti) : env(env), jvmti(jvmti) {
+    jthread currentThread;
+    jvmtiError err = jvmti->GetCurrentThread(&currentThread);
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Failed to get current thread");
+        return;
+    }
+
     jint threadCnt;
     jthread *threads;
-    jvmtiError err = jvmti->GetAllThreads(&threadCnt, &threads);
+    err = jvmti->GetAllThreads(&threadCnt, &threads);
     if (!isOk(err)) {
         handleError(jvmti, err, "Failed to get all threads");
+        env->DeleteLocalRef(currentThread);
         return;
     }
 
-    jthread currentThread;
-    err = jvmti->GetCurrentThread(&currentThread);
-    if (!isOk(err)) {
-        handleError(jvmti, err, "Failed to get current thread");
+    std::vector<jthread> otherThreads;
+    otherThreads.reserve(threadCnt);
+    for (jint i = 0; i < threadCnt; i++) {
+        if (env->IsSameObject(threads[i], currentThread)) {
+            env->DeleteLocalRef(threads[i]);
+        } else {
+            otherThreads.push_back(threads[i]);
+        }
+    }
+    jvmti->Deallocate(reinterpret_cast<unsigned char *>(threads));
+    env->DeleteLocalRef(currentThread);
+    if (otherThreads.empty()) {
         return;
     }
 
-    jvmtiThreadInfo currentThreadInfo;
-    jvmti->GetThreadInfo(currentThread, &currentThreadInfo);
+    std::vector<jvmtiError> results(otherThreads.size());
+    err = jvmti->SuspendThreadList(static_cast<jint>(otherThreads.size()), otherThreads.data(), results.data());
     if (!isOk(err)) {
-        handleError(jvmti, err, "Failed to get current thread's info");
-        return;
+        handleError(jvmti, err, "Failed to suspend threads");
     }
 
-    for (int i = 0; i < threadCnt; i++) {
-        jvmtiThreadInfo info;
-        jthread thread = threads[i];
-        err = jvmti->GetThreadInfo(thread, &info);
-        if (!isOk(err)) {
-            handleError(jvmti, err, "Failed to get thread's info");
-            return;
-        }
-
-        if (strcmp(info.name, currentThreadInfo.name) != 0) {
-            if (jvmti->SuspendThread(thread) == JVMTI_ERROR_NONE) {
-                suspendedThreads.push_back(thread);
-            }
+    suspendedThreads.reserve(otherThreads.size());
+    for (size_t i = 0; i < otherThreads.size(); i++) {
+        if (isOk(err) && results[i] == JVMTI_ERROR_NONE) {
+            suspendedThreads.push_back(otherThreads[i]);
+        } else {
+            env->DeleteLocalRef(otherThreads[i]);
         }
     }
 }
 
 ThreadSuspender::~ThreadSuspender() {
-    for (jthread thread : suspendedThreads) {
-        jvmtiError err = jvmti->ResumeThread(thread);
-        if (!isOk(err)) {
-            handleError(jvmti, err, "Failed to resume thread");
+    if (suspendedThreads.empty()) {
+        return;
+    }
+
+    std::vector<jvmtiError> results(suspendedThreads.size());
+    jvmtiError err = jvmti->ResumeThreadList(static_cast<jint>(suspendedThreads.size()), suspendedThreads.data(), results.data());
+    if (!isOk(err)) {
+        handleError(jvmti, err, "Failed to resume threads");
+    }
+
+    for (size_t i = 0; i < suspendedThreads.size(); i++) {
+        if (isOk(err) && !isOk(results[i])) {
+            handleError(jvmti, results[i], "Failed to resume thread");
         }
+        env->DeleteLocalRef(suspendedThreads[i]);
     }
 }
@@ -9,12 +9,14 @@
 #include <functional>
 #include <jvmti.h>
 
+// Suspends all threads except the current one while alive
 class ThreadSuspender {
 public:
-    explicit ThreadSuspender(jvmtiEnv *jvmti);
+    ThreadSuspender(JNIEnv *env, jvmtiEnv *jvmti);
     ~ThreadSuspender();
 
 private:
+    JNIEnv *env;
     jvmtiEnv *jvmti;
     std::vector<jthread> suspendedThreads;
 };
@@ -71,8 +73,6 @@ bool fileExists(const std::string &fileName);
 
 std::string jstringTostring(JNIEnv *env, jstring jStr);
 
-jmethodID getIsAssignableFromMethod(JNIEnv *env);
-
 std::string getToString(JNIEnv *env, jobject klass);
 
 template<typename T>
@@ -9,6 +9,12 @@ class AllocationListenerHolder {
         this.trackedClasses = trackedClasses;
     }
 
+    private void notifyListenerIfNeeded(Thread[] threads, Object[] objects, Class<?>[] classes, long[] sizes) {
+        for (int i = 0; i < objects.length; i++) {
+            notifyListenerIfNeeded(threads[i], objects[i], classes[i], sizes[i]);
+        }
+    }
+
     private void notifyListenerIfNeeded(Thread thread, Object obj, Class<?> objClass, long size) {
         if (trackedClasses.length == 0) {
             notifyListener(thread, obj, objClass, size);
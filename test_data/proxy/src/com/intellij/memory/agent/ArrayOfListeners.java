@@ -1,5 +1,9 @@
 package com.intellij.memory.agent;
 
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
 class ArrayOfListeners {
     public Object[] listenerHolders;
 
@@ -33,6 +37,22 @@ class ArrayOfListeners {
         listenerHolders = temp;
     }
 
+    /**
+     * @return Classes tracked by at least one listener or null if some listener tracks all classes.
+     */
+    Class<?>[] getTrackedClasses() {
+        List<Class<?>> result = new ArrayList<>();
+        for (Object holder : listenerHolders) {
+            Class<?>[] trackedClasses = ((AllocationListenerHolder)holder).trackedClasses;
+            if (trackedClasses.length == 0) {
+                return null;
+            }
+            result.addAll(Arrays.asList(trackedClasses));
+        }
+
+        return result.toArray(new Class<?>[0]);
+    }
+
     private int findListener(AllocationListener allocationListener) {
         for (int i = 0; i < listenerHolders.length; i++) {
             if (((AllocationListenerHolder)listenerHolders[i]).listener.equals(allocationListener)) {
@@ -4,6 +4,8 @@ public class IdeaNativeAgentProxy {
   public String cancellationFileName;
   public String progressFileName;
   public long timeoutInMillis;
+  public int ignoredReferenceKinds;
+  public long ignoredThreadId = -1;
 
   static {
     String agentPath = System.getProperty("intellij.memory.agent.path");
@@ -28,6 +30,11 @@ public class IdeaNativeAgentProxy {
     this.timeoutInMillis = timeoutInMillis;
   }
 
+  public void setReferenceFilter(int ignoredReferenceKinds, long ignoredThreadId) {
+    this.ignoredReferenceKinds = ignoredReferenceKinds;
+    this.ignoredThreadId = ignoredThreadId;
+  }
+
   public native boolean canEstimateObjectSize();
 
   public native boolean canGetRetainedSizeByClasses();
@@ -40,6 +47,8 @@ public class IdeaNativeAgentProxy {
 
   public native Object[] getShallowSizeByClasses(Object[] classes);
 
+  public native Object[] getClassHistogram(int classesLimit);
+
   public native Object[] getRetainedSizeByClasses(Object[] classes);
 
   public native Object[] getShallowAndRetainedSizeByClasses(Object[] classes);
@@ -48,24 +57,74 @@ public class IdeaNativeAgentProxy {
 
   public native Object[] size(Object object);
 
+  public native Object[] deepSize(Object object, int depthLimit);
+
+  public native Object[] getHeldObjectsHistogram(Object object);
+
+  public native Object[] getHeldObjectsOfClass(Object object, Object classObject, int offset, int limit);
+
   public native Object[] estimateRetainedSize(Object[] objects);
 
   public native Object[] getFirstReachableObject(Object startObject, Object suspectClass);
 
   public native Object[] getAllReachableObjects(Object startObject, Object suspectClass);
 
+  public native Object[] getReachableObjectsOfClasses(Object startObject, Object[] classes, int mode);
+
+  public native Object[] getReachableObjectsStatisticsOfClasses(Object startObject, Object[] classes, int samplesLimit);
+
+  public native Object[] getReachabilityOverlap(Object[] objects);
+
   public native Object[] getShallowAndRetainedSizesByObjects(Object[] objects);
 
+  public native Object[] getShallowAndRetainedSizesAndHeldObjectsByObjects(Object[] objects);
+
+  public native Object[] getShallowAndRetainedSizesByGroups(Object[] objects, int[] groupIds);
+
   public native Object[] getSortedShallowAndRetainedSizesByClass(Object classRef, long limit);
 
+  public native Object[] getRetainedSizesByThreads();
+
+  public native Object[] getReferringObjects(Object[] objects, int offset, int limit);
+
+  public native Object[] findPathBetweenObjects(Object source, Object target, int depthLimit);
+
+  public native boolean watchObjects(Object[] objects);
+
+  public native Object[] getWatchedObjectsSurvivors(int minGcCycles);
+
+  public native void clearWatchedObjects();
+
   static native boolean setHeapSamplingInterval(long interval);
 
+  static native boolean setAdaptiveHeapSampling(long samplesPerSecond, int minInterval, int maxInterval);
+
   static native boolean initArrayOfListeners(Object array);
 
+  static native boolean updateAllocationListeners(Object[] listenerHolders, Object[] trackedClasses);
+
   static native boolean enableAllocationSampling();
 
   static native boolean disableAllocationSampling();
 
+  static native boolean setAllocationStackDepth(int depth);
+
+  static native Object[] getAllocationSites();
+
+  static native void clearAllocationSites();
+
+  static native boolean startAllocationProfileExport(String path, long periodMillis);
+
+  static native void stopAllocationProfileExport();
+
+  static native boolean setLiveObjectsSampling(boolean enabled);
+
+  static native Object[] getLiveSampledObjects(boolean bySite);
+
+  static native boolean setClassAllocationCounting(boolean enabled);
+
+  static native Object[] getClassAllocationCountersDelta();
+
   public static boolean isLoaded() {
     try {
       return isLoadedImpl();
@@ -2,6 +2,8 @@ package com.intellij.memory.agent;
 
 import java.io.File;
 import java.lang.reflect.Array;
+import java.util.HashMap;
+import java.util.Map;
 import java.util.concurrent.Callable;
 
 /**
@@ -28,8 +30,11 @@ public class MemoryAgent {
         static Exception loadingException = null;
         static {
             try {
-                File agentLib = AgentExtractor.extract(new File(System.getProperty("java.io.tmpdir")));
-                System.load(agentLib.getAbsolutePath());
+                // The agent may be loaded already, e.g. with -agentpath
+                if (!IdeaNativeAgentProxy.isLoaded()) {
+                    File agentLib = AgentExtractor.extract(new File(System.getProperty("java.io.tmpdir")));
+                    System.load(agentLib.getAbsolutePath());
+                }
             } catch (Exception ex) {
                 loadingException = ex;
             }
@@ -115,6 +120,7 @@ public class MemoryAgent {
             }
         }
         listeners.add(allocationListener, trackedClasses);
+        updateAllocationListeners();
     }
 
     /**
@@ -164,6 +170,19 @@ public class MemoryAgent {
     public synchronized void removeAllocationListener(AllocationListener allocationListener) {
         if (listeners != null) {
             listeners.remove(allocationListener);
+            try {
+                updateAllocationListeners();
+            } catch (MemoryAgentExecutionException ignored) {
+                // The agent can't deliver allocation events in this case, so there is nobody to notify
+            }
+        }
+    }
+
+    private void updateAllocationListeners() throws MemoryAgentExecutionException {
+        Object[] listenerHolders = listeners.listenerHolders;
+        Class<?>[] trackedClasses = listeners.getTrackedClasses();
+        if (!callProxyMethod(() -> IdeaNativeAgentProxy.updateAllocationListeners(listenerHolders, trackedClasses))) {
+            throw new MemoryAgentExecutionException(allocationSamplingIsNotSupportedMessage);
         }
     }
 
@@ -180,9 +199,27 @@ public class MemoryAgent {
         }
     }
 
+    /**
+     * Lets the agent adjust the heap sampling interval, so that the number of allocation samples per second
+     * approaches the target one. Setting a fixed interval with {@link #setHeapSamplingInterval} disables it.
+     * Aggregated allocation sizes stay estimates of allocated bytes whatever the interval was.
+     *
+     * @param targetSamplesPerSecond Desired number of samples per second, 0 disables the adaptive mode.
+     * @param minInterval The smallest interval in bytes the agent may set, bounds the profiling overhead.
+     * @param maxInterval The largest interval in bytes the agent may set, 0 means no limit.
+     * @throws MemoryAgentExecutionException if a call to a native method failed or
+     * allocation sampling is not supported
+     */
+    public void setAdaptiveHeapSampling(long targetSamplesPerSecond, int minInterval, int maxInterval) throws MemoryAgentExecutionException {
+        if (!callProxyMethod(() -> IdeaNativeAgentProxy.setAdaptiveHeapSampling(targetSamplesPerSecond, minInterval, maxInterval))) {
+            throw new MemoryAgentExecutionException(allocationSamplingIsNotSupportedMessage);
+        }
+    }
+
     /**
      * Enables allocation sampling events. Allocation sampling is enabled by default
-     * if the running JVM supports it.
+     * if the running JVM supports it. Events are generated only while there are allocation
+     * listeners or allocation stacks, live objects or allocation rates are collected.
      *
      * @see <a href="https://openjdk.java.net/jeps/331">Low-Overhead Heap Profiling</a>
      * @throws MemoryAgentExecutionException if a call to a native method failed or
@@ -204,6 +241,181 @@ public class MemoryAgent {
         callProxyMethod(IdeaNativeAgentProxy::disableAllocationSampling);
     }
 
+    /**
+     * Sets the depth of allocation stacks captured for sampled allocations. Bytes and counts of
+     * sampled allocations are aggregated per allocation stack and class in the agent.
+     *
+     * @param depth Maximal number of captured frames, 0 disables capturing of allocation stacks.
+     * @throws MemoryAgentExecutionException if a call to a native method failed or
+     * allocation sampling is not supported
+     */
+    public void setAllocationStackDepth(int depth) throws MemoryAgentExecutionException {
+        if (!callProxyMethod(() -> IdeaNativeAgentProxy.setAllocationStackDepth(depth))) {
+            throw new MemoryAgentExecutionException(allocationSamplingIsNotSupportedMessage);
+        }
+    }
+
+    /**
+     * Returns sampled allocations aggregated per allocation stack and class in the folded format,
+     * one line per site: frames from the outermost one separated by semicolons, the allocated class
+     * and the estimated allocated bytes, e.g. {@code Main.main;Foo.bar;java.lang.String 524288}.
+     *
+     * @return Folded allocation stacks suitable for flame graph tools.
+     * @throws MemoryAgentExecutionException if a call to a native method failed.
+     * @see #setAllocationStackDepth
+     */
+    public String[] getAllocationFlameGraph() throws MemoryAgentExecutionException {
+        return toFoldedLines(callProxyMethod(IdeaNativeAgentProxy::getAllocationSites));
+    }
+
+    /**
+     * Drops all aggregated allocation stacks.
+     *
+     * @throws MemoryAgentExecutionException if a call to a native method failed.
+     */
+    public void clearAllocationFlameGraph() throws MemoryAgentExecutionException {
+        callProxyMethod(() -> {
+            IdeaNativeAgentProxy.clearAllocationSites();
+            return null;
+        });
+    }
+
+    /**
+     * Starts streaming sampled allocations aggregated per allocation stack and class to a file.
+     * Every period the agent appends the changes since the previous record in a compact varint
+     * encoding together with the class, method and stack tables they refer to. Stacks are captured
+     * with the depth set by {@link #setAllocationStackDepth}, without it allocations are recorded per class.
+     *
+     * @param path The file to write the profile to, it is overwritten.
+     * @param periodMillis The period of writing records in milliseconds.
+     * @throws MemoryAgentExecutionException if a call to a native method failed, the export is already
+     * running or allocation sampling is not supported
+     */
+    public void startAllocationProfileExport(String path, long periodMillis) throws MemoryAgentExecutionException {
+        if (!callProxyMethod(() -> IdeaNativeAgentProxy.startAllocationProfileExport(path, periodMillis))) {
+            throw new MemoryAgentExecutionException("Couldn't start allocation profile export");
+        }
+    }
+
+    /**
+     * Stops the allocation profile export. Returns after the last record is written and the file is closed.
+     *
+     * @throws MemoryAgentExecutionException if a call to a native method failed.
+     */
+    public void stopAllocationProfileExport() throws MemoryAgentExecutionException {
+        callProxyMethod(() -> {
+            IdeaNativeAgentProxy.stopAllocationProfileExport();
+            return null;
+        });
+    }
+
+    /**
+     * Enables or disables tracking of sampled objects until they are garbage collected.
+     * Objects sampled while the tracking is enabled stay tracked until they are freed.
+     *
+     * @param enabled Whether objects sampled from now on should be tracked.
+     * @throws MemoryAgentExecutionException if a call to a native method failed or
+     * allocation sampling is not supported
+     */
+    public void setLiveHeapSamplingEnabled(boolean enabled) throws MemoryAgentExecutionException {
+        if (!callProxyMethod(() -> IdeaNativeAgentProxy.setLiveObjectsSampling(enabled))) {
+            throw new MemoryAgentExecutionException(allocationSamplingIsNotSupportedMessage);
+        }
+    }
+
+    /**
+     * Returns sampled objects that are still alive, without walking the heap. Lines have
+     * the same format as in {@link #getAllocationFlameGraph()}, sizes are estimated like there.
+     *
+     * @param bySite Whether to group live objects by allocation stack and class or by class only.
+     * @return Estimated bytes of live objects per allocation site or per class.
+     * @throws MemoryAgentExecutionException if a call to a native method failed.
+     * @see #setLiveHeapSamplingEnabled
+     */
+    public String[] getLiveSampledHeap(boolean bySite) throws MemoryAgentExecutionException {
+        return toFoldedLines(callProxyMethod(() -> IdeaNativeAgentProxy.getLiveSampledObjects(bySite)));
+    }
+
+    /**
+     * Enables or disables native counting of sampled allocations per class.
+     *
+     * @param enabled Whether sampled allocations should be counted.
+     * @throws MemoryAgentExecutionException if a call to a native method failed or
+     * allocation sampling is not supported
+     */
+    public void setAllocationRateCountersEnabled(boolean enabled) throws MemoryAgentExecutionException {
+        if (!callProxyMethod(() -> IdeaNativeAgentProxy.setClassAllocationCounting(enabled))) {
+            throw new MemoryAgentExecutionException(allocationSamplingIsNotSupportedMessage);
+        }
+    }
+
+    /**
+     * Returns sampled allocation rates per class since the previous call of this method.
+     *
+     * @return Map from class names to estimated bytes allocated per second.
+     * @throws MemoryAgentExecutionException if a call to a native method failed.
+     * @see #setAllocationRateCountersEnabled
+     */
+    public Map<String, Double> getAllocationRates() throws MemoryAgentExecutionException {
+        Object[] delta = callProxyMethod(IdeaNativeAgentProxy::getClassAllocationCountersDelta);
+        String[] classNames = (String[]) delta[0];
+        long[] sizes = (long[]) delta[2];
+        double seconds = Math.max(((long[]) delta[3])[0], 1) / 1e9;
+        Map<String, Double> result = new HashMap<>();
+        for (int i = 0; i < classNames.length; i++) {
+            result.put(classNames[i], sizes[i] / seconds);
+        }
+        return result;
+    }
+
+    /**
+     * Adds objects to the watch list. Watched objects are not held by the agent and leave the list
+     * when they are garbage collected.
+     *
+     * @param objects Objects expected to be garbage collected soon.
+     * @throws MemoryAgentExecutionException if a call to a native method failed.
+     */
+    public synchronized void watchObjects(Object... objects) throws MemoryAgentExecutionException {
+        if (!callProxyMethod(() -> proxy.watchObjects(objects))) {
+            throw new MemoryAgentExecutionException(failedToCallNativeMethodMessage);
+        }
+    }
+
+    /**
+     * Returns watched objects that are still alive after the given number of garbage collections
+     * since they were added to the watch list.
+     *
+     * @param minGcCycles The minimal number of garbage collections an object should survive.
+     * @return An array of watched objects that survived at least {@code minGcCycles} garbage collections.
+     * @throws MemoryAgentExecutionException if a call to a native method failed.
+     * @see #watchObjects
+     */
+    public synchronized Object[] getWatchedObjectsSurvivors(int minGcCycles) throws MemoryAgentExecutionException {
+        return (Object[]) callProxyMethod(() -> proxy.getWatchedObjectsSurvivors(minGcCycles))[0];
+    }
+
+    /**
+     * Removes all objects from the watch list.
+     *
+     * @throws MemoryAgentExecutionException if a call to a native method failed.
+     */
+    public synchronized void clearWatchedObjects() throws MemoryAgentExecutionException {
+        callProxyMethod(() -> {
+            proxy.clearWatchedObjects();
+            return null;
+        });
+    }
+
+    private static String[] toFoldedLines(Object[] sites) {
+        String[] stacks = (String[]) sites[0];
+        long[] sizes = (long[]) sites[2];
+        String[] result = new String[stacks.length];
+        for (int i = 0; i < stacks.length; i++) {
+            result[i] = stacks[i] + " " + sizes[i];
+        }
+        return result;
+    }
+
     private static Object getResult(Object result) {
         return ((Object[])result)[1];
     }
@@ -0,0 +1,34 @@
+package allocation;
+
+import com.intellij.memory.agent.MemoryAgent;
+import common.TestBase;
+
+public class AllocationFlameGraph extends TestBase {
+    private static final Object[] payloads = new Object[10];
+
+    public static void main(String[] args) throws Exception {
+        MemoryAgent agent = MemoryAgent.get();
+        agent.setAllocationStackDepth(2);
+        sampleEveryAllocation(agent);
+        agent.clearAllocationFlameGraph();
+
+        allocatePayloads();
+        printFoldedStacks(agent.getAllocationFlameGraph(), payloads[0]);
+
+        agent.clearAllocationFlameGraph();
+        printFoldedStacks(agent.getAllocationFlameGraph(), payloads[0]);
+
+        allocatePayloads();
+        allocatePayloads();
+        printFoldedStacks(agent.getAllocationFlameGraph(), payloads[0]);
+    }
+
+    private static void allocatePayloads() {
+        for (int i = 0; i < payloads.length; i++) {
+            payloads[i] = new Payload();
+        }
+    }
+
+    private static class Payload {
+    }
+}
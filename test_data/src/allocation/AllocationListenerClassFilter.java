@@ -0,0 +1,49 @@
+package allocation;
+
+import com.intellij.memory.agent.MemoryAgent;
+import common.TestBase;
+
+import java.util.Map;
+import java.util.TreeMap;
+
+public class AllocationListenerClassFilter extends TestBase {
+    private static final Object[] objects = new Object[10];
+    private static final Map<String, Integer> receivedClasses = new TreeMap<>();
+
+    public static void main(String[] args) throws Exception {
+        MemoryAgent agent = MemoryAgent.get();
+        agent.addAllocationListener(info -> {
+            synchronized (receivedClasses) {
+                receivedClasses.merge(info.getObjectClass().getName(), 1, Integer::sum);
+            }
+        }, Payload.class);
+        sampleEveryAllocation(agent);
+
+        for (int i = 0; i < objects.length; i++) {
+            objects[i] = new Other();
+        }
+        for (int i = 0; i < objects.length; i++) {
+            objects[i] = i % 2 == 0 ? new Payload() : new SubPayload();
+        }
+
+        // Samples are delivered in the order of allocations, so all of them are delivered after the last one
+        waitFor(() -> {
+            synchronized (receivedClasses) {
+                return receivedClasses.getOrDefault(SubPayload.class.getName(), 0) == objects.length / 2;
+            }
+        });
+        synchronized (receivedClasses) {
+            System.out.println("Received allocations:");
+            receivedClasses.forEach((name, count) -> System.out.printf("  %s: %d%n", name, count));
+        }
+    }
+
+    private static class Payload {
+    }
+
+    private static class SubPayload extends Payload {
+    }
+
+    private static class Other {
+    }
+}
@@ -0,0 +1,120 @@
+package allocation;
+
+import com.intellij.memory.agent.MemoryAgent;
+import common.TestBase;
+
+import java.io.*;
+import java.nio.file.Files;
+import java.util.*;
+
+public class AllocationProfileExport extends TestBase {
+    private static final int CLASS = 1;
+    private static final int METHOD = 2;
+    private static final int STACK = 3;
+    private static final int SAMPLES = 4;
+
+    private static final Object[] payloads = new Object[10];
+
+    public static void main(String[] args) throws Exception {
+        File file = File.createTempFile("memory_agent_allocation_profile", ".mapf");
+        file.deleteOnExit();
+
+        MemoryAgent agent = MemoryAgent.get();
+        agent.setAllocationStackDepth(2);
+        agent.startAllocationProfileExport(file.getPath(), 10);
+        sampleEveryAllocation(agent);
+
+        allocatePayloads();
+        // Allocations of the next period go to another SAMPLES record
+        Thread.sleep(100);
+        allocatePayloads();
+        agent.stopAllocationProfileExport();
+        allocatePayloads();
+
+        printDecodedProfile(Files.readAllBytes(file.toPath()));
+    }
+
+    private static void allocatePayloads() {
+        for (int i = 0; i < payloads.length; i++) {
+            payloads[i] = new Payload();
+        }
+    }
+
+    private static void printDecodedProfile(byte[] profile) throws IOException {
+        DataInputStream input = new DataInputStream(new ByteArrayInputStream(profile));
+        byte[] magic = new byte[4];
+        input.readFully(magic);
+        System.out.printf("Magic: %s, version: %d%n", new String(magic, "US-ASCII"), readVarint(input));
+
+        Map<Long, String> classes = new HashMap<>();
+        Map<Long, String> methods = new HashMap<>();
+        Map<Long, String> stacks = new HashMap<>();
+        Map<String, Long> sizesBySite = new TreeMap<>();
+        Map<String, Long> countsBySite = new TreeMap<>();
+        int type;
+        while ((type = input.read()) != -1) {
+            switch (type) {
+                case CLASS:
+                    classes.put(readVarint(input), readString(input));
+                    break;
+                case METHOD:
+                    methods.put(readVarint(input), readString(input));
+                    break;
+                case STACK: {
+                    long id = readVarint(input);
+                    StringBuilder folded = new StringBuilder();
+                    for (long i = readVarint(input); i > 0; i--) {
+                        folded.append(getDefined(methods, readVarint(input))).append(';');
+                    }
+                    stacks.put(id, folded.toString());
+                    break;
+                }
+                case SAMPLES:
+                    readVarint(input);
+                    for (long i = readVarint(input); i > 0; i--) {
+                        String site = getDefined(stacks, readVarint(input)) + getDefined(classes, readVarint(input));
+                        countsBySite.merge(site, readVarint(input), Long::sum);
+                        sizesBySite.merge(site, readVarint(input), Long::sum);
+                    }
+                    break;
+                default:
+                    fail("Unknown record type: " + type);
+            }
+        }
+
+        String payloadClassName = Payload.class.getName();
+        long payloadSize = getShallowSize(payloads[0]);
+        System.out.println("Exported allocations of " + payloadClassName + ":");
+        countsBySite.forEach((site, count) -> {
+            if (site.endsWith(payloadClassName)) {
+                System.out.printf("  %s: %d objects, sizes match: %b%n", site, count, sizesBySite.get(site) == count * payloadSize);
+            }
+        });
+    }
+
+    private static String getDefined(Map<Long, String> definitions, long id) {
+        String definition = definitions.get(id);
+        assertTrue(definition != null, "Id " + id + " is used before its record");
+        return definition;
+    }
+
+    private static String readString(DataInputStream input) throws IOException {
+        byte[] bytes = new byte[(int) readVarint(input)];
+        input.readFully(bytes);
+        return new String(bytes, "UTF-8");
+    }
+
+    private static long readVarint(DataInputStream input) throws IOException {
+        long result = 0;
+        for (int shift = 0; ; shift += 7) {
+            int b = input.readUnsignedByte();
+            result |= (long) (b & 0x7F) << shift;
+            if ((b & 0x80) == 0) {
+                return result;
+            }
+        }
+    }
+
+    private static class Payload {
+    }
+}
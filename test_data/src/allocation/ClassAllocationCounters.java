@@ -0,0 +1,57 @@
+package allocation;
+
+import com.intellij.memory.agent.MemoryAgent;
+import common.TestBase;
+
+import java.util.Map;
+
+public class ClassAllocationCounters extends TestBase {
+    private static final Object[] payloads = new Object[10];
+    private static final Object[] others = new Object[10];
+
+    public static void main(String[] args) throws Exception {
+        MemoryAgent agent = MemoryAgent.get();
+        agent.setAllocationRateCountersEnabled(true);
+        sampleEveryAllocation(agent);
+        agent.getAllocationRates();
+
+        allocatePayloads();
+        allocateOthers();
+        printAllocatedClasses(agent.getAllocationRates());
+
+        allocatePayloads();
+        printAllocatedClasses(agent.getAllocationRates());
+
+        printAllocatedClasses(agent.getAllocationRates());
+
+        agent.setAllocationRateCountersEnabled(false);
+        allocateOthers();
+        printAllocatedClasses(agent.getAllocationRates());
+    }
+
+    private static void allocatePayloads() {
+        for (int i = 0; i < payloads.length; i++) {
+            payloads[i] = new Payload();
+        }
+    }
+
+    private static void allocateOthers() {
+        for (int i = 0; i < others.length; i++) {
+            others[i] = new Other();
+        }
+    }
+
+    private static void printAllocatedClasses(Map<String, Double> rates) {
+        System.out.println("Allocated since the previous read:");
+        for (Class<?> klass : new Class<?>[]{Payload.class, Other.class}) {
+            Double rate = rates.get(klass.getName());
+            System.out.printf("  %s: %s%n", klass.getName(), rate == null ? "nothing" : rate > 0 ? "allocated" : "no bytes");
+        }
+    }
+
+    private static class Payload {
+    }
+
+    private static class Other {
+    }
+}
@@ -0,0 +1,52 @@
+package allocation;
+
+import com.intellij.memory.agent.MemoryAgent;
+import common.TestBase;
+
+public class LiveSampledObjects extends TestBase {
+    private static final Object[] kept = new Object[10];
+
+    public static void main(String[] args) throws Exception {
+        MemoryAgent agent = MemoryAgent.get();
+        agent.setLiveHeapSamplingEnabled(true);
+        sampleEveryAllocation(agent);
+
+        allocatePayloads(kept);
+        Object[] dropped = new Object[20];
+        allocatePayloads(dropped);
+        printLivePayloads(agent);
+
+        dropped = null;
+        // ObjectFree events may be posted after the collection finished
+        waitFor(() -> {
+            System.gc();
+            return countLivePayloads(agent) == kept.length;
+        });
+        printLivePayloads(agent);
+
+        agent.setLiveHeapSamplingEnabled(false);
+        allocatePayloads(new Object[5]);
+        printLivePayloads(agent);
+    }
+
+    private static void allocatePayloads(Object[] payloads) {
+        for (int i = 0; i < payloads.length; i++) {
+            payloads[i] = new Payload();
+        }
+    }
+
+    private static long countLivePayloads(MemoryAgent agent) {
+        try {
+            return countFoldedObjects(agent.getLiveSampledHeap(false), Payload.class.getName(), kept[0]);
+        } catch (Exception ex) {
+            throw new AssertionError(ex);
+        }
+    }
+
+    private static void printLivePayloads(MemoryAgent agent) {
+        System.out.printf("Live sampled objects of %s: %d%n", Payload.class.getName(), countLivePayloads(agent));
+    }
+
+    private static class Payload {
+    }
+}
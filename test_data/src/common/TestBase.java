@@ -1,9 +1,12 @@
 package common;
 
 import com.intellij.memory.agent.IdeaNativeAgentProxy;
+import com.intellij.memory.agent.MemoryAgent;
+import com.intellij.memory.agent.MemoryAgentExecutionException;
 
 import java.lang.management.ManagementFactory;
 import java.util.*;
+import java.util.function.BooleanSupplier;
 import java.util.function.Function;
 import java.util.stream.Collectors;
 
@@ -39,6 +42,8 @@ public abstract class TestBase {
   protected static final IdeaNativeAgentProxy proxy = new IdeaNativeAgentProxy(
           DEFAULT_CANCELLATION_FILE_PATH, DEFAULT_PROGRESS_FILE_PATH, DEFAULT_TIMEOUT
   );
+  private static final long ALLOCATION_WAIT_TIMEOUT_MILLIS = 10000;
+  private static Object samplingWarmUp;
   private static final Map<Integer, String> referenceDescription = new HashMap<>();
   static {
     referenceDescription.put(1, "CLASS");
@@ -100,12 +105,77 @@ public abstract class TestBase {
     printObjectsSortedByName(objects);
   }
 
+  protected static void printFirstReachableObjectsOfClasses(Object startObject, Class<?>... classes) {
+    Object[] found = (Object[]) ((Object[]) proxy.getReachableObjectsOfClasses(startObject, classes, 0))[1];
+    for (int i = 0; i < classes.length; i++) {
+      System.out.printf("%s is%sreachable%n", classes[i].getName(), found[i] != null ? " " : " not ");
+    }
+  }
+
+  protected static void printAllReachableObjectsOfClasses(Object startObject, Class<?>... classes) {
+    Object[] found = (Object[]) ((Object[]) proxy.getReachableObjectsOfClasses(startObject, classes, 1))[1];
+    for (int i = 0; i < classes.length; i++) {
+      printReachableObjects((Object[]) found[i], classes[i]);
+    }
+  }
+
+  protected static void printReachabilityOverlap(Object... objects) {
+    Object result = proxy.getReachabilityOverlap(objects);
+    Object[] arrayResult = (Object[]) ((Object[]) result)[1];
+    long[] reachableSizes = (long[]) arrayResult[0];
+    long[] exclusiveSizes = (long[]) arrayResult[1];
+    Object[] sharedSizes = (Object[]) arrayResult[2];
+    for (int i = 0; i < objects.length; i++) {
+      System.out.printf("%s: Reachable size: %d, Exclusive size: %d\n", objects[i], reachableSizes[i], exclusiveSizes[i]);
+    }
+    for (int i = 0; i < objects.length; i++) {
+      for (int j = i + 1; j < objects.length; j++) {
+        System.out.printf("%s and %s: Shared size: %d\n", objects[i], objects[j], ((long[]) sharedSizes[i])[j]);
+      }
+    }
+  }
+
+  protected static void printReachableObjectsStatisticsOfClasses(Object startObject, int samplesLimit, Class<?>... classes) {
+    Object[] result = (Object[]) ((Object[]) proxy.getReachableObjectsStatisticsOfClasses(startObject, classes, samplesLimit))[1];
+    long[] counts = (long[]) result[0];
+    long[] sizes = (long[]) result[1];
+    Object[] samples = (Object[]) result[2];
+    for (int i = 0; i < classes.length; i++) {
+      Object[] classSamples = (Object[]) samples[i];
+      boolean samplesOfClass = Arrays.stream(classSamples).allMatch(classes[i]::isInstance);
+      System.out.printf("%s: %d reachable objects, %d bytes, %d samples%s%n", classes[i].getName(), counts[i], sizes[i],
+                        classSamples.length, samplesOfClass ? "" : " of wrong class");
+    }
+  }
+
+  protected static void printReachableObjectsCountsOfClasses(Object startObject, Class<?>... classes) {
+    long[] counts = (long[]) ((Object[]) proxy.getReachableObjectsOfClasses(startObject, classes, 2))[1];
+    for (int i = 0; i < classes.length; i++) {
+      System.out.printf("%s: %d reachable objects%n", classes[i].getName(), counts[i]);
+    }
+  }
+
   protected static void printSize(Object object) {
     Object result = proxy.size(object);
     Object[] arrayResult = (Object[]) ((Object[]) result)[1];
     System.out.println(((long[])arrayResult[0])[1]);
   }
 
+  protected static void printDeepSize(Object object, int depthLimit) {
+    Object[] arrayResult = (Object[]) ((Object[]) proxy.deepSize(object, depthLimit))[1];
+    long[] total = (long[]) arrayResult[0];
+    Object[] classes = (Object[]) arrayResult[1];
+    long[] counts = (long[]) arrayResult[2];
+    long[] sizes = (long[]) arrayResult[3];
+    System.out.printf("Deep size: %d bytes in %d objects%n", total[0], total[1]);
+    Integer[] order = new Integer[classes.length];
+    for (int i = 0; i < order.length; i++) order[i] = i;
+    Arrays.sort(order, Comparator.comparing(i -> ((Class<?>) classes[i]).getName()));
+    for (int i : order) {
+      System.out.printf("  %s: %d objects, %d bytes%n", ((Class<?>) classes[i]).getName(), counts[i], sizes[i]);
+    }
+  }
+
   protected static void printSizeAndHeldObjects(Object object) {
     Object result = proxy.size(object);
     Object[] arrayResult = (Object[]) ((Object[]) result)[1];
@@ -115,6 +185,76 @@ public abstract class TestBase {
     printObjectsSortedByName((Object[])arrayResult[1]);
   }
 
+  protected static void printClassHistogram(int classesLimit, String classNamePrefix) {
+    Object[] arrayResult = (Object[]) ((Object[]) proxy.getClassHistogram(classesLimit))[1];
+    Object[] classes = (Object[]) arrayResult[0];
+    long[] counts = (long[]) arrayResult[1];
+    long[] sizes = (long[]) arrayResult[2];
+    boolean sorted = true;
+    for (int i = 1; i < sizes.length; i++) {
+      sorted &= sizes[i - 1] >= sizes[i];
+    }
+    System.out.printf("Class histogram of %s classes, sorted: %b%n", classesLimit < 0 ? "all" : classes.length + "", sorted);
+    for (int i = 0; i < classes.length; i++) {
+      String name = ((Class<?>) classes[i]).getName();
+      if (name.startsWith(classNamePrefix)) {
+        System.out.printf("  %s: %d objects, %d bytes%n", name, counts[i], sizes[i]);
+      }
+    }
+  }
+
+  protected static void printHeldObjectsHistogram(Object object) {
+    Object[] arrayResult = (Object[]) ((Object[]) proxy.getHeldObjectsHistogram(object))[1];
+    long[] sizes = (long[]) arrayResult[0];
+    Object[] classes = (Object[]) arrayResult[1];
+    long[] counts = (long[]) arrayResult[2];
+    long[] classSizes = (long[]) arrayResult[3];
+    System.out.printf("Shallow size: %d, Retained size: %d\n", sizes[0], sizes[1]);
+    System.out.println("Held objects by classes:");
+    Integer[] order = new Integer[classes.length];
+    for (int i = 0; i < order.length; i++) order[i] = i;
+    Arrays.sort(order, Comparator.<Integer>comparingLong(i -> -classSizes[i]).thenComparing(i -> ((Class<?>) classes[i]).getName()));
+    for (int i : order) {
+      System.out.printf("  %s: %d objects, %d bytes%n", ((Class<?>) classes[i]).getName(), counts[i], classSizes[i]);
+    }
+  }
+
+  protected static void printHeldObjectsOfClass(Object object, Class<?> heldClass, int offset, int limit) {
+    Object[] arrayResult = (Object[]) ((Object[]) proxy.getHeldObjectsOfClass(object, heldClass, offset, limit))[1];
+    Object[] objects = (Object[]) arrayResult[0];
+    int total = ((int[]) arrayResult[1])[0];
+    System.out.printf("Held objects of %s [%d, %d) of %d: %d%n", heldClass.getName(), offset, offset + limit, total, objects.length);
+    for (Object heldObject : objects) {
+      if (heldObject.getClass() != heldClass) {
+        System.out.println("Unexpected object: " + heldObject);
+      }
+    }
+  }
+
+  protected static void printSizesAndHeldObjects(Object... objects) {
+    Object result = proxy.getShallowAndRetainedSizesAndHeldObjectsByObjects(objects);
+    Object[] arrayResult = (Object[]) ((Object[]) result)[1];
+    long[] shallowSizes = (long[]) arrayResult[0];
+    long[] retainedSizes = (long[]) arrayResult[1];
+    Object[] heldObjects = (Object[]) arrayResult[2];
+    for (int i = 0; i < objects.length; i++) {
+      System.out.printf("%s: Shallow size: %d, Retained size: %d\n", objects[i], shallowSizes[i], retainedSizes[i]);
+      System.out.println("Held objects:");
+      printObjectsSortedByName((Object[]) heldObjects[i]);
+    }
+  }
+
+  protected static void printSizesByGroups(int[] groupIds, Object... objects) {
+    Object result = proxy.getShallowAndRetainedSizesByGroups(objects, groupIds);
+    Object[] arrayResult = (Object[]) ((Object[]) result)[1];
+    int[] groups = (int[]) arrayResult[0];
+    long[] shallowSizes = (long[]) arrayResult[1];
+    long[] retainedSizes = (long[]) arrayResult[2];
+    for (int i = 0; i < groups.length; i++) {
+      System.out.printf("Group %d: Shallow size: %d, Retained size: %d\n", groups[i], shallowSizes[i], retainedSizes[i]);
+    }
+  }
+
   protected static void printObjectsSortedByName(Object[] objects) {
     List<String> objectsNames = new ArrayList<>();
     for (Object obj : objects) {
@@ -150,6 +290,28 @@ public abstract class TestBase {
     }
   }
 
+  protected static void printRetainedSizesOfMainLocals(int... slots) {
+    Object[] arrayResult = (Object[]) ((Object[]) proxy.getRetainedSizesByThreads())[1];
+    Object[] threads = (Object[]) arrayResult[0];
+    Object[] frames = (Object[]) arrayResult[3];
+    System.out.println("Retained sizes of main locals:");
+    for (int i = 0; i < threads.length; i++) {
+      if (threads[i] != Thread.currentThread()) continue;
+      Object[] threadFrames = (Object[]) frames[i];
+      Object[] methods = (Object[]) threadFrames[1];
+      Object[] locals = (Object[]) threadFrames[3];
+      for (int j = 0; j < methods.length; j++) {
+        if (!"main".equals(((String[]) methods[j])[0])) continue;
+        int[] frameSlots = (int[]) ((Object[]) locals[j])[0];
+        long[] sizes = (long[]) ((Object[]) locals[j])[1];
+        for (int slot : slots) {
+          int index = Arrays.binarySearch(frameSlots, slot);
+          System.out.println("\tslot " + slot + " -> " + (index >= 0 ? Long.toString(sizes[index]) : "not found"));
+        }
+      }
+    }
+  }
+
   private static void printSizesOfObjects(Object[] objects, long[] shallowSizes, long[] retainedSizes) {
     System.out.println("Shallow sizes:");
     printSizeByObjects(objects, shallowSizes);
@@ -251,6 +413,91 @@ public abstract class TestBase {
     }
   }
 
+  protected static void printReferringObjects(Object object) {
+    Object[] arrayResult = (Object[]) ((Object[]) proxy.getReferringObjects(new Object[]{object}, 0, DEFAULT_OBJECTS_LIMIT))[1];
+    Object[] referrers = (Object[]) arrayResult[0];
+    int[] kinds = (int[]) arrayResult[2];
+    Object[] infos = (Object[]) arrayResult[3];
+    int total = ((int[]) arrayResult[4])[0];
+    assertEquals(total, referrers.length);
+
+    List<String> references = new ArrayList<>();
+    for (int i = 0; i < referrers.length; i++) {
+      String refFrom = referrers[i] == null ? "root" : asString(referrers[i]);
+      references.add(String.format("[%s :: %s :: %s]", refFrom, referenceDescription.get(kinds[i]), interpretInfo(kinds[i], infos[i])));
+    }
+    references.sort(String::compareTo);
+    System.out.println("Referring objects of " + asString(object) + ":");
+    references.forEach(System.out::println);
+  }
+
+  protected static void printReferringObjectsPage(Object object, int offset, int limit) {
+    Object[] arrayResult = (Object[]) ((Object[]) proxy.getReferringObjects(new Object[]{object}, offset, limit))[1];
+    Object[] referrers = (Object[]) arrayResult[0];
+    int total = ((int[]) arrayResult[4])[0];
+    System.out.printf("Page [%d, %d): %d of %d referring objects%n", offset, offset + limit, referrers.length, total);
+  }
+
+  protected static void printPathBetweenObjects(Object source, Object target, int depthLimit) {
+    System.out.printf("Path from %s to %s with depth limit %d:%n", asString(source), asString(target), depthLimit);
+    doPrintGcRoots(proxy.findPathBetweenObjects(source, target, depthLimit));
+  }
+
+  protected static void printWatchedObjectsSurvivors(int minGcCycles) {
+    System.out.printf("Watched objects survived %d gc cycles:%n", minGcCycles);
+    Object[] result = proxy.getWatchedObjectsSurvivors(minGcCycles);
+    Object[] survivors = (Object[]) result[0];
+    long[] survivedGcCycles = (long[]) result[1];
+    assertEquals(survivors.length, survivedGcCycles.length);
+    for (long cycles : survivedGcCycles) {
+      assertTrue(cycles >= minGcCycles);
+    }
+
+    printObjectsSortedByName(survivors);
+  }
+
+  // Call it when allocation events are consumed already, the pending sample point is reached only then
+  protected static void sampleEveryAllocation(MemoryAgent agent) throws MemoryAgentExecutionException {
+    agent.setHeapSamplingInterval(0);
+    // Threads keep the next sample point picked with the previous interval, a large allocation passes it
+    samplingWarmUp = new byte[1 << 22];
+  }
+
+  protected static long getShallowSize(Object object) {
+    Object[] arrayResult = (Object[]) ((Object[]) proxy.size(object))[1];
+    return ((long[]) arrayResult[0])[0];
+  }
+
+  // With every allocation sampled sizes are exact, so counts of allocated objects are derived from them
+  protected static long countFoldedObjects(String[] foldedLines, String stackSuffix, Object instance) {
+    long size = 0;
+    for (String line : foldedLines) {
+      int separator = line.lastIndexOf(' ');
+      String stack = line.substring(0, separator);
+      if (stack.equals(stackSuffix) || stack.endsWith(";" + stackSuffix)) {
+        size += Long.parseLong(line.substring(separator + 1));
+      }
+    }
+    return size / getShallowSize(instance);
+  }
+
+  protected static void printFoldedStacks(String[] foldedLines, Object instance) {
+    String className = instance.getClass().getName();
+    System.out.println("Folded stacks of " + className + ":");
+    Arrays.stream(foldedLines)
+      .map(line -> line.substring(0, line.lastIndexOf(' ')))
+      .filter(stack -> stack.endsWith(className))
+      .sorted()
+      .forEach(stack -> System.out.printf("  %s: %d objects%n", stack, countFoldedObjects(foldedLines, stack, instance)));
+  }
+
+  protected static void waitFor(BooleanSupplier condition) throws InterruptedException {
+    long deadline = System.currentTimeMillis() + ALLOCATION_WAIT_TIMEOUT_MILLIS;
+    while (!condition.getAsBoolean() && System.currentTimeMillis() < deadline) {
+      Thread.sleep(10);
+    }
+  }
+
   private static String interpretInfo(int kind, Object info) {
     if (kind == 2 || kind == 8 // field or static field
         || kind == 3 // array element
@@ -262,6 +509,7 @@ public abstract class TestBase {
       Object[] infos = (Object[]) info;
       assertEquals(2, infos.length);
       long[] stackInfo = (long[]) infos[0];
+      assertEquals(4, stackInfo.length);
       return "thread id = " + stackInfo[0] + " depth = " + stackInfo[1] + " slot = " + stackInfo[2];
     }
 
@@ -0,0 +1,23 @@
+package reachability;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+import java.lang.ref.WeakReference;
+
+public class ReachabilityOfManyClasses extends TestBase {
+    public static void main(String[] args) {
+        TestTreeNode root = TestTreeNode.createTreeFromString("2 1 0 0 1 0 0");
+        WeakReference<TestTreeNode> ref = new WeakReference<>(TestTreeNode.createTreeFromString("3 4 0 0 0"));
+        Class<?>[] classes = {TestTreeNode.Impl1.class, TestTreeNode.class, TestTreeNode.Impl3.class, TestTreeNode.Impl4.class};
+        printFirstReachableObjectsOfClasses(null, classes);
+        printReachableObjectsCountsOfClasses(null, classes);
+        printAllReachableObjectsOfClasses(null, classes);
+        printAllReachableObjectsOfClasses(root, TestTreeNode.class, TestTreeNode.Impl2.class, TestTreeNode.class);
+        printReachableObjectsCountsOfClasses(root.left, classes);
+
+        // unknown modes are rejected
+        assertTrue(((Object[]) proxy.getReachableObjectsOfClasses(null, classes, 3))[1] == null);
+        assertTrue(((Object[]) proxy.getReachableObjectsOfClasses(null, classes, -1))[1] == null);
+    }
+}
@@ -0,0 +1,20 @@
+package reachability;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class ReachabilityOverlap extends TestBase {
+    public static void main(String[] args) {
+        TestTreeNode first = TestTreeNode.createTreeFromString("2 1 0 0 1 0 0");
+        TestTreeNode second = TestTreeNode.createTreeFromString("3 1 0 0 0");
+        TestTreeNode third = TestTreeNode.createTreeFromString("4 0 0");
+        second.right = first.left;
+        third.left = first.left;
+        third.right = second.left;
+        printReachabilityOverlap(first, second, third);
+
+        // everything reachable from the second tree becomes reachable from the first one
+        first.right.left = second;
+        printReachabilityOverlap(first, second, third);
+    }
+}
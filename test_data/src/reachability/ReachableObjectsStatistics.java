@@ -0,0 +1,18 @@
+package reachability;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class ReachableObjectsStatistics extends TestBase {
+    public static void main(String[] args) {
+        TestTreeNode root = TestTreeNode.createTreeFromString("2 1 0 0 1 0 0");
+        TestTreeNode[] nodes = new TestTreeNode[10];
+        for (int i = 0; i < nodes.length; i++) {
+            nodes[i] = new TestTreeNode.Impl3();
+        }
+
+        printReachableObjectsStatisticsOfClasses(null, 3, TestTreeNode.Impl1.class, TestTreeNode.Impl3.class, TestTreeNode.class, TestTreeNode.Impl4.class);
+        printReachableObjectsStatisticsOfClasses(null, 0, TestTreeNode.Impl3.class);
+        printReachableObjectsStatisticsOfClasses(root, 5, TestTreeNode.class);
+    }
+}
@@ -0,0 +1,18 @@
+package roots;
+
+import common.Reference;
+import common.TestBase;
+
+public class PathBetweenObjects extends TestBase {
+  public static void main(String[] args) {
+    Object target = createTestObject("target");
+    Object[] array = new Object[]{target};
+    Reference longPath = new Reference(new Reference(new Reference(target)));
+    Reference source = new Reference(longPath, array);
+    printPathBetweenObjects(source, target, -1);
+    printPathBetweenObjects(source, target, 2);
+    printPathBetweenObjects(source, target, 1);
+    printPathBetweenObjects(target, source, -1);
+    printPathBetweenObjects(longPath, longPath, 0);
+  }
+}
@@ -0,0 +1,15 @@
+package roots;
+
+import common.Reference;
+import common.TestBase;
+
+public class ReferringObjects extends TestBase {
+  public static void main(String[] args) {
+    Object target = createTestObject("target");
+    Object[] array = new Object[]{null, target, target};
+    Reference reference = new Reference(target);
+    printReferringObjects(target);
+    printReferringObjectsPage(target, 1, 3);
+    printReferringObjectsPage(target, 4, 3);
+  }
+}
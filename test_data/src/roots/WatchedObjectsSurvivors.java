@@ -0,0 +1,25 @@
+package roots;
+
+import common.TestBase;
+
+public class WatchedObjectsSurvivors extends TestBase {
+    public static void main(String[] args) {
+        Object kept = createTestObject("kept");
+        Object dropped = createTestObject("dropped");
+        assertTrue(proxy.watchObjects(new Object[]{kept, dropped}));
+        printWatchedObjectsSurvivors(0);
+
+        dropped = null;
+        System.gc();
+        System.gc();
+        printWatchedObjectsSurvivors(1);
+
+        Object fresh = createTestObject("fresh");
+        assertTrue(proxy.watchObjects(new Object[]{kept, fresh}));
+        printWatchedObjectsSurvivors(0);
+        printWatchedObjectsSurvivors(1);
+
+        proxy.clearWatchedObjects();
+        printWatchedObjectsSurvivors(0);
+    }
+}
@@ -0,0 +1,15 @@
+package size;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class ClassHistogram extends TestBase {
+    public static void main(String[] args) {
+        TestTreeNode[] nodes = new TestTreeNode[]{
+                new TestTreeNode.Impl3(), new TestTreeNode.Impl3(), new TestTreeNode.Impl3(),
+                new TestTreeNode.Impl4(), new TestTreeNode.Impl4()
+        };
+        printClassHistogram(-1, "common.TestTreeNode");
+        printClassHistogram(3, "common.TestTreeNode");
+    }
+}
@@ -0,0 +1,32 @@
+package size;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class DeepSize extends TestBase {
+    public static void main(String[] args) {
+        TestTreeNode root = TestTreeNode.createTreeFromString("2 1 0 0 1 0 0");
+        printDeepSize(root, -1);
+        printDeepSize(root, 0);
+
+        root.left.left = root;
+        root.right.right = root.left;
+        printDeepSize(root, -1);
+
+        Object[] array = new Object[]{root, root.right};
+        printDeepSize(array, 1);
+        printDeepSize(array, -1);
+
+        // the same node is reached through paths of different length
+        TestTreeNode leftChain = TestTreeNode.createTreeFromString("1 2 3 4 0 0 0 0 0");
+        leftChain.right = leftChain.left.left;
+        printDeepSize(leftChain, 2);
+
+        TestTreeNode rightChain = TestTreeNode.createTreeFromString("1 0 2 0 3 0 4 0 0");
+        rightChain.left = rightChain.right.right;
+        printDeepSize(rightChain, 2);
+
+        // an invalid start object is an error rather than the deep size of the whole heap
+        assertTrue(((Object[]) proxy.deepSize(null, -1))[1] == null);
+    }
+}
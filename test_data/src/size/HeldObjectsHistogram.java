@@ -0,0 +1,30 @@
+package size;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class HeldObjectsHistogram extends TestBase {
+    public static void main(String[] args) {
+        Object[] holder = new Object[]{
+                TestTreeNode.createTreeFromString("2 1 0 0 1 0 0"),
+                new TestTreeNode.Impl3(), new TestTreeNode.Impl3(), new TestTreeNode.Impl3()
+        };
+        printHeldObjectsHistogram(holder);
+        printHeldObjectsOfClass(holder, TestTreeNode.Impl3.class, 0, 10);
+        printHeldObjectsOfClass(holder, TestTreeNode.Impl3.class, 1, 1);
+        printHeldObjectsOfClass(holder, TestTreeNode.Impl3.class, 5, 1);
+        printHeldObjectsOfClass(holder, TestTreeNode.Impl4.class, 0, 10);
+
+        TestTreeNode shared = ((TestTreeNode) holder[0]).left;
+        printHeldObjectsHistogram(holder);
+        printHeldObjectsOfClass(holder, TestTreeNode.Impl1.class, 0, 10);
+
+        // next pages are read from the snapshot taken by the first one
+        printHeldObjectsOfClass(holder, TestTreeNode.Impl3.class, 0, 1);
+        Object notHeld = holder[1];
+        holder[1] = null;
+        printHeldObjectsOfClass(holder, TestTreeNode.Impl3.class, 1, 10);
+        printHeldObjectsOfClass(holder, TestTreeNode.Impl3.class, 0, 10);
+        assertTrue(notHeld != null);
+    }
+}
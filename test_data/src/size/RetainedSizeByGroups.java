@@ -0,0 +1,33 @@
+package size;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class RetainedSizeByGroups extends TestBase {
+    public static void main(String[] args) {
+        TestTreeNode[] services = new TestTreeNode[]{
+                TestTreeNode.createTreeFromString("2 1 0 0 0"),
+                TestTreeNode.createTreeFromString("3 1 0 0 0"),
+                TestTreeNode.createTreeFromString("4 0 0")
+        };
+        services[0].right = new TestTreeNode.Impl1();
+        services[1].right = services[0].right;
+
+        // the shared node is held by the first group as a whole
+        printSizesByGroups(new int[]{1, 1, 2}, services[0], services[1], services[2]);
+
+        services[2].left = services[0].right;
+        printSizesByGroups(new int[]{1, 1, 2}, services[0], services[1], services[2]);
+
+        // the shared node is held by none of the groups
+        services[2].left = null;
+        printSizesByGroups(new int[]{1, 2, 3}, services[0], services[1], services[2]);
+
+        // members hold subtrees sharing a deep node
+        TestTreeNode first = TestTreeNode.createTreeFromString("1 2 3 0 0 0 4 0 0");
+        TestTreeNode second = TestTreeNode.createTreeFromString("2 1 0 0 0");
+        second.left.right = first.left.left;
+        printSizesByGroups(new int[]{7, 7}, first, second);
+        printSizesByGroups(new int[]{7, 8}, first, second);
+    }
+}
@@ -0,0 +1,24 @@
+package size;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class RetainedSizeByThread extends TestBase {
+    public static void main(String[] args) {
+        /*
+            local 1    local 2
+               |          |
+               1          |
+             /   \        |
+            1     1       |
+             \            |
+               1  <-------
+        */
+        TestTreeNode first = TestTreeNode.createTreeFromString("1 1 0 0 1 0 0");
+        TestTreeNode second = TestTreeNode.createTreeFromString("1 0 0");
+        first.left.right = second;
+        printRetainedSizesOfMainLocals(1, 2);
+        second = null;
+        printRetainedSizesOfMainLocals(1, 2);
+    }
+}
@@ -0,0 +1,23 @@
+package size;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class WithHeldObjectsAndReferenceFilter extends TestBase {
+    private static final int FIELD_REFERENCE_KIND = 2;
+
+    public static void main(String[] args) {
+        TestTreeNode root = TestTreeNode.createTreeFromString("2 1 0 0 1 0 0");
+        TestTreeNode left = root.left;
+        printSizeAndHeldObjects(root);
+
+        proxy.setReferenceFilter(0, Thread.currentThread().getId());
+        printSizeAndHeldObjects(root);
+
+        proxy.setReferenceFilter(1 << FIELD_REFERENCE_KIND, -1);
+        printSizeAndHeldObjects(root);
+
+        proxy.setReferenceFilter(0, -1);
+        printSizeAndHeldObjects(left);
+    }
+}
@@ -0,0 +1,25 @@
+package size;
+
+import common.TestBase;
+import common.TestTreeNode;
+
+public class WithHeldObjectsOfManyObjects extends TestBase {
+    public static void main(String[] args) {
+        /*
+                  2
+                /   \
+               1 <-- 1
+             /  \\
+            1 --> 1 <-- 3
+        */
+        TestTreeNode root2 = TestTreeNode.createTreeFromString("2 1 1 0 0 1 0 0 1 0 0");
+        TestTreeNode root3 = new TestTreeNode.Impl3();
+        root2.right.left = root2.left;
+        root2.left.left.right = root2.left.right;
+        root2.left.right.left = root2.left;
+        printSizesAndHeldObjects(root2, root3, root2.right);
+        root3.left = root2.left.right;
+        printSizesAndHeldObjects(root2, root3, root2.right);
+        printSizesAndHeldObjects(root2.left, root2.left.right);
+    }
+}
@@ -0,0 +1,25 @@
+package size.classes;
+
+import common.TestBase;
+
+public class InterfacesAndArrays extends TestBase {
+    interface Base {
+
+    }
+
+    interface Derived extends Base {
+
+    }
+
+    static class Implementation implements Derived {
+
+    }
+
+    public static void main(String[] args) {
+        Implementation first = new Implementation();
+        Implementation second = new Implementation();
+        Derived[] derivedArray = new Implementation[]{first, second};
+        Base[] baseArray = new Base[4];
+        printShallowSizeByClasses(Base.class, Derived.class, Implementation.class, Base[].class, Derived[].class, Implementation[].class);
+    }
+}